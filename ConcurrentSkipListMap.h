@@ -0,0 +1,517 @@
+#ifndef AISDI_MAPS_CONCURRENTSKIPLISTMAP_H
+#define AISDI_MAPS_CONCURRENTSKIPLISTMAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "Epoch.h"
+
+namespace aisdi
+{
+
+// ordered map that any number of threads may read and write at once without locks. entries are
+// kept in a skip list whose links are changed only by compare-and-swap. a key is removed the
+// moment the low bit of its node's entry pointer is set, that mark decides which remover wins and
+// makes every later replacement fail. the node's outgoing links are then marked the same way, top
+// level first, and any thread that walks past a marked node unlinks it.
+// unlinked memory is reclaimed through epochs, so readers never see freed nodes.
+// an entry is immutable once published and upsert swaps in a new one by compare-and-swap against
+// the entry it read, so a reader holding an entry sees a consistent key and value. iterators are
+// weakly consistent: they never go backwards or visit a removed entry twice, and may or may not
+// see changes made during the scan. an iterator keeps its thread pinned, so it must stay on that
+// thread and should not be kept long
+template <typename KeyType, typename ValueType>
+class ConcurrentSkipListMap
+{
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using value_type = std::pair<const key_type, mapped_type>;
+  using size_type = std::size_t;
+  using const_reference = const value_type&;
+
+  class ConstIterator;
+  using const_iterator = ConstIterator;
+  using iterator = ConstIterator;
+
+  static constexpr int max_height = 24; // towers grow a level with probability 1/4, enough for 2^48 keys
+
+private:
+  using Link = std::atomic<std::uintptr_t>; // successor, the low bit marks the owner as removed on that level
+  using KeySlot = typename std::aligned_storage<sizeof(key_type), alignof(key_type)>::type;
+
+  struct Node
+  {
+    KeySlot key_slot; // left empty in the head
+    std::atomic<std::uintptr_t> entry; // the low bit marks the key as removed
+    // the inserter and the remover, the last one to let go retires the node. the inserter may
+    // still be linking upper levels after the remover unlinked them, so neither can retire alone
+    std::atomic<int> holders;
+    int height;
+    Link *next; // height links stored right after the node
+
+    Node(): entry(0), holders(2), height(0), next(nullptr) {}
+
+    const key_type& key() const
+    {
+      return *reinterpret_cast<const key_type*>(&key_slot);
+    }
+  };
+
+  Node *head;
+  std::atomic<size_type> size;
+
+  static bool marked(std::uintptr_t link)
+  {
+    return (link & 1) != 0;
+  }
+
+  static Node* pointer(std::uintptr_t link)
+  {
+    return reinterpret_cast<Node*>(link & ~std::uintptr_t(1));
+  }
+
+  static std::uintptr_t link_to(const Node *node)
+  {
+    return reinterpret_cast<std::uintptr_t>(node);
+  }
+
+  static const value_type* entry_of(std::uintptr_t entry)
+  {
+    return reinterpret_cast<const value_type*>(entry & ~std::uintptr_t(1));
+  }
+
+  static bool removed(const Node *node)
+  {
+    return marked(node->entry.load(std::memory_order_acquire));
+  }
+
+  static Node* allocate(int height)
+  {
+    char *memory = static_cast<char*>(::operator new(sizeof(Node) + height * sizeof(Link)));
+    Node *node = new (memory) Node();
+    node->height = height;
+    node->next = reinterpret_cast<Link*>(memory + sizeof(Node));
+    for (int level = 0; level < height; level++) new (&node->next[level]) Link(0);
+    return node;
+  }
+
+  static Node* make_node(const key_type& key, const value_type *entry, int height)
+  {
+    Node *node = allocate(height);
+    new (&node->key_slot) key_type(key);
+    node->entry.store(reinterpret_cast<std::uintptr_t>(entry), std::memory_order_relaxed);
+    return node;
+  }
+
+  static void destroy(Node *node)
+  {
+    node->key().~key_type();
+    delete entry_of(node->entry.load(std::memory_order_relaxed));
+    node->~Node();
+    ::operator delete(node);
+  }
+
+  static void retire_node(void *node)
+  {
+    destroy(static_cast<Node*>(node));
+  }
+
+  static void retire_entry(void *entry)
+  {
+    delete static_cast<const value_type*>(entry);
+  }
+
+  static int random_height()
+  {
+    static thread_local std::uint64_t state = 0;
+    if (state == 0) state = (reinterpret_cast<std::uintptr_t>(&state) * 0x9e3779b97f4a7c15ULL) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    std::uint64_t bits = state;
+    int height = 1;
+    while (height < max_height && (bits & 3) == 0)
+    {
+      height++;
+      bits >>= 2;
+    }
+    return height;
+  }
+
+  // one pass of search, false if a link changed under it and it has to start over
+  bool try_search(const key_type& key, Node **preds, Node **succs) const
+  {
+    Node *pred = head;
+    for (int level = max_height - 1; level >= 0; level--)
+    {
+      Node *current = pointer(pred->next[level].load(std::memory_order_acquire));
+      while (current != nullptr)
+      {
+        std::uintptr_t successor = current->next[level].load(std::memory_order_acquire);
+        if (marked(successor))
+        {
+          std::uintptr_t expected = link_to(current);
+          if (!pred->next[level].compare_exchange_strong(expected, successor & ~std::uintptr_t(1),
+                                                         std::memory_order_acq_rel, std::memory_order_acquire))
+            return false;
+          current = pointer(successor);
+          continue;
+        }
+        if (!(current->key() < key)) break;
+        pred = current;
+        current = pointer(successor);
+      }
+      preds[level] = pred;
+      succs[level] = current;
+    }
+    return true;
+  }
+
+  // finds the neighbours of key on every level, unlinking removed nodes on the way.
+  // returns whether succs[0] is a node holding key
+  bool search(const key_type& key, Node **preds, Node **succs) const
+  {
+    while (!try_search(key, preds, succs)) {}
+    return succs[0] != nullptr && !(key < succs[0]->key());
+  }
+
+  // first node not removed with a key not lower than key, reads only and skips removed nodes
+  Node* lower_node(const key_type& key) const
+  {
+    Node *pred = head, *current = nullptr;
+    for (int level = max_height - 1; level >= 0; level--)
+    {
+      current = pointer(pred->next[level].load(std::memory_order_acquire));
+      while (current != nullptr)
+      {
+        std::uintptr_t successor = current->next[level].load(std::memory_order_acquire);
+        if (!marked(successor) && !(current->key() < key) && !removed(current)) break;
+        if (!marked(successor) && current->key() < key) pred = current;
+        current = pointer(successor);
+      }
+    }
+    return current;
+  }
+
+  static Node* next_alive(const Node *node)
+  {
+    Node *next = pointer(node->next[0].load(std::memory_order_acquire));
+    std::uintptr_t successor;
+    while (next != nullptr && (marked(successor = next->next[0].load(std::memory_order_acquire)) || removed(next)))
+      next = pointer(successor);
+    return next;
+  }
+
+  static void release(Node *node)
+  {
+    if (node->holders.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      detail::EpochDomain::global().retire(node, retire_node);
+  }
+
+  // finishes the removal of a node whose entry is marked: marks its links, so nothing is linked
+  // behind it any more, and unlinks it from every level. any thread that meets such a node may
+  // do this, the remover does it too
+  void unlink_removed(Node *node, Node **preds, Node **succs)
+  {
+    for (int level = node->height - 1; level >= 0; level--)
+      node->next[level].fetch_or(1, std::memory_order_acq_rel);
+    search(node->key(), preds, succs);
+  }
+
+  // links the upper levels of a node already linked on level 0. stops once the node is being
+  // removed, and if that happened it unlinks whatever it linked, as the remover may be done
+  void link_tower(Node *node, Node **preds, Node **succs)
+  {
+    bool removed = false;
+    for (int level = 1; level < node->height && !removed; level++)
+      while (true)
+      {
+        std::uintptr_t successor = node->next[level].load(std::memory_order_acquire);
+        if (marked(successor))
+        {
+          removed = true;
+          break;
+        }
+        // a failed exchange means the link was marked meanwhile, which the next round sees
+        if (successor != link_to(succs[level]) &&
+            !node->next[level].compare_exchange_strong(successor, link_to(succs[level]), std::memory_order_acq_rel))
+          continue;
+        std::uintptr_t expected = link_to(succs[level]);
+        if (preds[level]->next[level].compare_exchange_strong(expected, link_to(node), std::memory_order_acq_rel))
+          break;
+        if (!search(node->key(), preds, succs) || succs[0] != node)
+        {
+          removed = true;
+          break;
+        }
+      }
+    if (marked(node->next[0].load(std::memory_order_acquire))) search(node->key(), preds, succs);
+    release(node);
+  }
+
+  // adds key with value unless it is present, in which case the entry is replaced if replace
+  // is set. returns true if the key was added
+  bool put(const key_type& key, mapped_type value, bool replace)
+  {
+    detail::EpochGuard guard;
+    Node *preds[max_height], *succs[max_height];
+    const value_type *entry = new value_type(key, std::move(value));
+    Node *node = nullptr;
+    while (true)
+    {
+      if (search(key, preds, succs))
+      {
+        if (node != nullptr)
+        {
+          node->entry.store(0, std::memory_order_relaxed);
+          destroy(node);
+          node = nullptr;
+        }
+        Node *found = succs[0];
+        std::uintptr_t old = found->entry.load(std::memory_order_acquire);
+        // a replacement fails once the key is removed, the key is then added again as a new node
+        while (!marked(old) && replace &&
+               !found->entry.compare_exchange_weak(old, reinterpret_cast<std::uintptr_t>(entry),
+                                                   std::memory_order_acq_rel, std::memory_order_acquire)) {}
+        if (marked(old))
+        {
+          unlink_removed(found, preds, succs);
+          continue;
+        }
+        if (replace) detail::EpochDomain::global().retire(const_cast<value_type*>(entry_of(old)), retire_entry);
+        else delete entry;
+        return false;
+      }
+      if (node == nullptr) node = make_node(key, entry, random_height());
+      for (int level = 0; level < node->height; level++)
+        node->next[level].store(link_to(succs[level]), std::memory_order_relaxed);
+      // counted before it can be seen, so a remover never takes the size below zero
+      size.fetch_add(1, std::memory_order_relaxed);
+      std::uintptr_t expected = link_to(succs[0]);
+      if (!preds[0]->next[0].compare_exchange_strong(expected, link_to(node), std::memory_order_acq_rel))
+      {
+        size.fetch_sub(1, std::memory_order_relaxed);
+        continue;
+      }
+      link_tower(node, preds, succs);
+      return true;
+    }
+  }
+
+public:
+  ConcurrentSkipListMap(): head(allocate(max_height)), size(0) {}
+
+  ConcurrentSkipListMap(std::initializer_list<value_type> list): ConcurrentSkipListMap()
+  {
+    for (auto it = list.begin(); it != list.end(); ++it)
+      upsert(it->first, it->second);
+  }
+
+  // other threads may hold pointers into the nodes, so the map stays where it was built
+  ConcurrentSkipListMap(const ConcurrentSkipListMap&) = delete;
+  ConcurrentSkipListMap& operator=(const ConcurrentSkipListMap&) = delete;
+
+  // no other thread may use the map any more, removed nodes are left to the epoch domain
+  ~ConcurrentSkipListMap()
+  {
+    Node *current = pointer(head->next[0].load(std::memory_order_relaxed)), *next;
+    for (; current != nullptr; current = next)
+    {
+      next = pointer(current->next[0].load(std::memory_order_relaxed));
+      destroy(current);
+    }
+    head->~Node();
+    ::operator delete(head);
+  }
+
+  // the size is kept exactly, but while writers run it is only a snapshot
+  size_type getSize() const
+  {
+    return size.load(std::memory_order_relaxed);
+  }
+
+  bool isEmpty() const
+  {
+    detail::EpochGuard guard;
+    return next_alive(head) == nullptr;
+  }
+
+  // inserts or replaces the value, returns true if the key was not there
+  bool upsert(const key_type& key, mapped_type value)
+  {
+    return put(key, std::move(value), true);
+  }
+
+  // inserts the value unless the key is present, returns true if it was inserted
+  bool insert(const key_type& key, mapped_type value)
+  {
+    return put(key, std::move(value), false);
+  }
+
+  // entries may be replaced at any time, so the value is returned by copy
+  mapped_type valueOf(const key_type& key) const
+  {
+    detail::EpochGuard guard;
+    Node *node = lower_node(key);
+    if (node == nullptr || key < node->key()) throw std::out_of_range("such key doesn't exist");
+    std::uintptr_t entry = node->entry.load(std::memory_order_acquire);
+    if (marked(entry)) throw std::out_of_range("such key doesn't exist");
+    return entry_of(entry)->second;
+  }
+
+  bool contains(const key_type& key) const
+  {
+    detail::EpochGuard guard;
+    Node *node = lower_node(key);
+    return node != nullptr && !(key < node->key());
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    ConstIterator it;
+    it.move_to(lower_node(key));
+    if (it.node != nullptr && key < it.node->key()) it.move_to(nullptr);
+    return it;
+  }
+
+  // first entry with a key not lower than key
+  const_iterator lower_bound(const key_type& key) const
+  {
+    ConstIterator it;
+    it.move_to(lower_node(key));
+    return it;
+  }
+
+  // first entry with a key greater than key
+  const_iterator upper_bound(const key_type& key) const
+  {
+    ConstIterator it;
+    it.move_to(lower_node(key));
+    if (it.node != nullptr && !(key < it.node->key())) ++it;
+    return it;
+  }
+
+  // removes the key, returns false if it was not there or another thread removed it first
+  bool erase(const key_type& key)
+  {
+    detail::EpochGuard guard;
+    Node *preds[max_height], *succs[max_height];
+    if (!search(key, preds, succs)) return false;
+    Node *node = succs[0];
+    if (marked(node->entry.fetch_or(1, std::memory_order_acq_rel))) return false;
+    size.fetch_sub(1, std::memory_order_relaxed);
+    unlink_removed(node, preds, succs);
+    release(node);
+    return true;
+  }
+
+  void remove(const key_type& key)
+  {
+    if (!erase(key)) throw std::out_of_range("such key doesn't exist");
+  }
+
+  // calls f for every entry with first <= key < last, in key order
+  template <typename Function>
+  void for_each_in_range(const key_type& first, const key_type& last, Function f) const
+  {
+    detail::EpochGuard guard;
+    for (Node *node = lower_node(first); node != nullptr && node->key() < last; node = next_alive(node))
+      f(static_cast<const_reference>(*entry_of(node->entry.load(std::memory_order_acquire))));
+  }
+
+  const_iterator cbegin() const
+  {
+    ConstIterator it;
+    it.move_to(next_alive(head));
+    return it;
+  }
+
+  const_iterator cend() const
+  {
+    return ConstIterator();
+  }
+
+  const_iterator begin() const
+  {
+    return cbegin();
+  }
+
+  const_iterator end() const
+  {
+    return cend();
+  }
+};
+
+// holds the node it stands on and the entry it had when the iterator got there, both stay
+// valid while the iterator lives since it keeps its thread pinned
+template <typename KeyType, typename ValueType>
+class ConcurrentSkipListMap<KeyType, ValueType>::ConstIterator
+{
+  friend class ConcurrentSkipListMap;
+public:
+  using reference = typename ConcurrentSkipListMap::const_reference;
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = typename ConcurrentSkipListMap::value_type;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const typename ConcurrentSkipListMap::value_type*;
+
+private:
+  detail::EpochGuard guard;
+  Node *node; // nullptr is end
+  const value_type *entry;
+
+  // target must have been found while this iterator was already pinned
+  void move_to(Node *target)
+  {
+    node = target;
+    entry = target != nullptr ? entry_of(target->entry.load(std::memory_order_acquire)) : nullptr;
+  }
+public:
+  ConstIterator(): node(nullptr), entry(nullptr) {}
+
+  ConstIterator& operator++()
+  {
+    if (node == nullptr) throw std::out_of_range("cannot increment end iterator");
+    move_to(next_alive(node));
+    return *this;
+  }
+
+  ConstIterator operator++(int)
+  {
+    ConstIterator it(*this);
+    operator++();
+    return it;
+  }
+
+  reference operator*() const
+  {
+    if (node == nullptr) throw std::out_of_range("cannot dereference end iterator");
+    return *entry;
+  }
+
+  pointer operator->() const
+  {
+    return &this->operator*();
+  }
+
+  bool operator==(const ConstIterator& other) const
+  {
+    return node == other.node;
+  }
+
+  bool operator!=(const ConstIterator& other) const
+  {
+    return node != other.node;
+  }
+};
+
+}
+
+#endif /* AISDI_MAPS_CONCURRENTSKIPLISTMAP_H */
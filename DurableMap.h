@@ -0,0 +1,837 @@
+#ifndef AISDI_MAPS_DURABLEMAP_H
+#define AISDI_MAPS_DURABLEMAP_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "HashMap.h"
+#include "TreeMap.h"
+
+namespace aisdi
+{
+
+// encodes keys and values in log records and checkpoints. trivially copyable types are stored
+// as their bytes, std::string with its length. other types need a specialization with the same
+// two members, read returns false if the data ends too early
+template <typename T, typename Enable = void>
+struct Serializer
+{
+  static_assert(std::is_trivially_copyable<T>::value, "Serializer has to be specialized for this type");
+
+  static void write(std::string& out, const T& value)
+  {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  static bool read(const char*& data, const char *end, T& value)
+  {
+    if (static_cast<std::size_t>(end - data) < sizeof(T)) return false;
+    std::memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+  }
+};
+
+template <>
+struct Serializer<std::string>
+{
+  static void write(std::string& out, const std::string& value)
+  {
+    std::uint64_t length = value.size();
+    Serializer<std::uint64_t>::write(out, length);
+    out.append(value);
+  }
+
+  static bool read(const char*& data, const char *end, std::string& value)
+  {
+    std::uint64_t length;
+    if (!Serializer<std::uint64_t>::read(data, end, length)) return false;
+    if (static_cast<std::uint64_t>(end - data) < length) return false;
+    value.assign(data, static_cast<std::size_t>(length));
+    data += length;
+    return true;
+  }
+};
+
+// moments after which a crash leaves the files in a different state, see DurabilityOptions::crash_point
+enum class DurabilityPoint
+{
+  record_queued, // a writer handed a record to the flusher, nothing is written yet
+  log_written, // the flusher wrote a batch of records, before syncing them
+  checkpoint_written, // the new checkpoint is complete in checkpoint.tmp, before the rename
+  checkpoint_renamed // the checkpoint replaced the old one, before the logs it covers are deleted
+};
+
+struct DurabilityOptions
+{
+  std::chrono::milliseconds commit_interval; // longest a record waits for the flusher to write and sync it
+  std::size_t checkpoint_bytes; // log volume after which the map is checkpointed and older logs dropped
+  std::size_t max_pending_bytes; // writers wait for the flusher once this much is buffered
+  bool sync; // without it the files are still written in order, but not forced to disk
+  // for tests, called at each of those moments on the thread that reaches it, e.g. to kill the process
+  void (*crash_point)(DurabilityPoint point);
+
+  DurabilityOptions(): commit_interval(5), checkpoint_bytes(std::size_t(64) << 20),
+    max_pending_bytes(std::size_t(256) << 20), sync(true), crash_point(nullptr) {}
+};
+
+namespace detail
+{
+
+// contents of a map frozen for a checkpoint, which the flusher serializes while writers go on.
+// only maps that hand out a snapshot in O(1) are frozen. freezing any other map would mean
+// copying it on the writer, so for those the flusher rebuilds the checkpoint from the files
+template <typename Map>
+class CheckpointContents
+{
+public:
+  static constexpr bool frozen = false;
+};
+
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class CheckpointContents<TreeMap<KeyType, ValueType, InlineCapacity>>
+{
+  using Snapshot = typename TreeMap<KeyType, ValueType, InlineCapacity>::Snapshot;
+
+  Snapshot contents;
+
+public:
+  static constexpr bool frozen = true;
+
+  explicit CheckpointContents(TreeMap<KeyType, ValueType, InlineCapacity>& map): contents(map.snapshot()) {}
+
+  const Snapshot& view() const
+  {
+    return contents;
+  }
+};
+
+// crc32c (castagnoli), with the sse4.2 instruction when the target has it
+inline std::uint32_t crc32c(const char *data, std::size_t length)
+{
+  std::uint32_t crc = ~std::uint32_t(0);
+#if defined(__SSE4_2__) && defined(__x86_64__)
+  std::uint64_t wide = crc;
+  for (; length >= 8; data += 8, length -= 8)
+  {
+    std::uint64_t word;
+    std::memcpy(&word, data, 8);
+    wide = _mm_crc32_u64(wide, word);
+  }
+  crc = static_cast<std::uint32_t>(wide);
+  for (; length > 0; data++, length--) crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+#else
+  struct Table
+  {
+    std::uint32_t entries[256];
+
+    Table()
+    {
+      for (std::uint32_t i = 0; i < 256; i++)
+      {
+        std::uint32_t value = i;
+        for (int bit = 0; bit < 8; bit++) value = (value & 1) ? (value >> 1) ^ 0x82f63b78u : value >> 1;
+        entries[i] = value;
+      }
+    }
+  };
+  static const Table table;
+  for (; length > 0; data++, length--)
+    crc = table.entries[(crc ^ static_cast<unsigned char>(*data)) & 0xff] ^ (crc >> 8);
+#endif
+  return ~crc;
+}
+
+inline void throw_errno(const std::string& what)
+{
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+inline void write_all(int fd, const char *data, std::size_t length, const std::string& path)
+{
+  while (length > 0)
+  {
+    ssize_t written = ::write(fd, data, length);
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+      throw_errno("cannot write " + path);
+    }
+    data += written;
+    length -= static_cast<std::size_t>(written);
+  }
+}
+
+inline void sync_file(int fd, const std::string& path)
+{
+#if defined(__linux__)
+  if (::fdatasync(fd) != 0) throw_errno("cannot sync " + path);
+#else
+  if (::fsync(fd) != 0) throw_errno("cannot sync " + path);
+#endif
+}
+
+// makes created, renamed and removed names in a directory durable
+inline void sync_directory(const std::string& path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw_errno("cannot open " + path);
+  int result = ::fsync(fd);
+  ::close(fd);
+  if (result != 0) throw_errno("cannot sync " + path);
+}
+
+// whole file into out, false if it does not exist
+inline bool read_file(const std::string& path, std::string& out)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    if (errno == ENOENT) return false;
+    throw_errno("cannot open " + path);
+  }
+  out.clear();
+  char buffer[1 << 16];
+  while (true)
+  {
+    ssize_t got = ::read(fd, buffer, sizeof(buffer));
+    if (got < 0)
+    {
+      if (errno == EINTR) continue;
+      ::close(fd);
+      throw_errno("cannot read " + path);
+    }
+    if (got == 0) break;
+    out.append(buffer, static_cast<std::size_t>(got));
+  }
+  ::close(fd);
+  return true;
+}
+
+}
+
+// map whose changes survive crashes. every put and remove appends a record to a write-ahead log
+// before it is applied, and a background flusher writes the log and syncs it in batches (group
+// commit), so writers only copy bytes into a buffer and never wait for the disk. once enough log
+// has piled up, the flusher writes a checkpoint (temporary file, sync, rename), after which older
+// logs are deleted. a TreeMap is frozen in an O(1) snapshot that the flusher serializes. other maps
+// are never touched: the flusher applies the logs since the previous checkpoint to a copy of that
+// checkpoint's file, keeping only the changes in those logs in memory. opening a directory
+// recovers the last checkpoint and replays the logs written after it; a torn record at the end
+// of the newest log, left by a crash in the middle of a write, is cut off.
+// records become durable within commit_interval, flush() waits until everything so far is.
+// files hold keys and values as Serializer writes them and are read back on the same kind of machine
+template <typename KeyType, typename ValueType, template <typename, typename, std::size_t> class MapType = HashMap>
+class DurableMap
+{
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using size_type = std::size_t;
+  using Map = MapType<KeyType, ValueType, 0>;
+  using const_iterator = typename Map::const_iterator;
+
+  class Assignment;
+
+private:
+  enum RecordType : std::uint8_t
+  {
+    put_record = 1,
+    remove_record = 2
+  };
+
+  static constexpr std::uint32_t checkpoint_magic = 0x4b435044; // "DPCK"
+  static constexpr std::size_t record_header = 8; // payload length and crc, both 32 bit
+
+  using Contents = detail::CheckpointContents<Map>;
+
+  // work for the flusher, done in order
+  struct Task
+  {
+    bool checkpoint; // otherwise log records
+    std::uint64_t generation; // log file the records go to, or the first one the checkpoint does not cover
+    std::string bytes; // log records
+    std::uint64_t last_record; // number of the last record in bytes
+    std::unique_ptr<const Contents> contents; // what the checkpoint holds
+  };
+
+  Map map;
+  std::string directory;
+  DurabilityOptions options;
+  std::uint64_t generation; // current log is wal.<generation>, a checkpoint covers all logs before its own
+  std::size_t logged_bytes; // log written since the last checkpoint
+  std::string record; // encoding scratch
+
+  // shared with the flusher
+  std::mutex lock;
+  std::condition_variable work; // wakes the flusher
+  std::condition_variable done; // wakes writers waiting for the flusher
+  std::deque<Task> pending;
+  std::size_t pending_bytes;
+  std::uint64_t appended; // records handed to the flusher
+  std::uint64_t durable; // records written and synced
+  std::uint64_t checkpoints_started;
+  std::uint64_t checkpoints_done;
+  bool urgent; // someone waits, the flusher skips the commit interval
+  bool stopping;
+  std::string failure; // first error of the flusher, every later write reports it
+  std::thread flusher;
+
+  std::string path(const std::string& name) const
+  {
+    return directory + "/" + name;
+  }
+
+  std::string log_path(std::uint64_t log_generation) const
+  {
+    return path("wal." + std::to_string(log_generation));
+  }
+
+  void check_failure() const
+  {
+    if (!failure.empty()) throw std::runtime_error(failure);
+  }
+
+  void reach(DurabilityPoint point) const
+  {
+    if (options.crash_point != nullptr) options.crash_point(point);
+  }
+
+  // parses the records of a log and hands them to put(key, value) and remove(key), returns the
+  // length of the valid prefix
+  template <typename Put, typename Remove>
+  static std::size_t parse_log(const std::string& bytes, Put put, Remove remove)
+  {
+    const char *begin = bytes.data(), *end = begin + bytes.size(), *data = begin;
+    while (static_cast<std::size_t>(end - data) >= record_header)
+    {
+      std::uint32_t length, crc;
+      std::memcpy(&length, data, 4);
+      std::memcpy(&crc, data + 4, 4);
+      const char *payload = data + record_header;
+      if (static_cast<std::size_t>(end - payload) < length || detail::crc32c(payload, length) != crc) break;
+      const char *field = payload + 1, *payload_end = payload + length;
+      key_type key;
+      if (length == 0 || !Serializer<key_type>::read(field, payload_end, key)) break;
+      if (static_cast<std::uint8_t>(*payload) == put_record)
+      {
+        mapped_type value;
+        if (!Serializer<mapped_type>::read(field, payload_end, value)) break;
+        put(key, std::move(value));
+      }
+      else if (static_cast<std::uint8_t>(*payload) == remove_record) remove(key);
+      else break;
+      data = payload_end;
+    }
+    return static_cast<std::size_t>(data - begin);
+  }
+
+  // applies the records of a log to the map, returns the length of the valid prefix
+  std::size_t replay(const std::string& bytes)
+  {
+    return parse_log(bytes, [this](const key_type& key, mapped_type value) { map[key] = std::move(value); },
+                     [this](const key_type& key)
+                     {
+                       if (map.find(key) != map.end()) map.remove(key);
+                     });
+  }
+
+  // checks a checkpoint and hands its entries to f(key, value), returns the generation of the
+  // first log it does not cover
+  template <typename Function>
+  std::uint64_t parse_checkpoint(const std::string& bytes, Function f) const
+  {
+    const char *data = bytes.data(), *end = data + bytes.size();
+    std::uint32_t magic, crc;
+    std::uint64_t covered, count;
+    if (bytes.size() < 4 || !Serializer<std::uint32_t>::read(data, end, magic) || magic != checkpoint_magic)
+      throw std::runtime_error("not a checkpoint: " + path("checkpoint"));
+    end -= 4;
+    std::memcpy(&crc, end, 4);
+    if (detail::crc32c(bytes.data(), bytes.size() - 4) != crc ||
+        !Serializer<std::uint64_t>::read(data, end, covered) || !Serializer<std::uint64_t>::read(data, end, count))
+      throw std::runtime_error("corrupt checkpoint: " + path("checkpoint"));
+    for (std::uint64_t i = 0; i < count; i++)
+    {
+      key_type key;
+      mapped_type value;
+      if (!Serializer<key_type>::read(data, end, key) || !Serializer<mapped_type>::read(data, end, value))
+        throw std::runtime_error("corrupt checkpoint: " + path("checkpoint"));
+      f(key, std::move(value));
+    }
+    return covered;
+  }
+
+  // loads a checkpoint, returns the generation of the first log it does not cover
+  std::uint64_t load_checkpoint(const std::string& bytes)
+  {
+    return parse_checkpoint(bytes, [this](const key_type& key, mapped_type value) { map[key] = std::move(value); });
+  }
+
+  std::vector<std::uint64_t> list_logs() const
+  {
+    std::vector<std::uint64_t> logs;
+    DIR *listing = ::opendir(directory.c_str());
+    if (listing == nullptr) detail::throw_errno("cannot list " + directory);
+    while (dirent *entry = ::readdir(listing))
+    {
+      const char *name = entry->d_name;
+      if (std::strncmp(name, "wal.", 4) != 0 || name[4] < '0' || name[4] > '9') continue;
+      char *rest;
+      std::uint64_t log_generation = std::strtoull(name + 4, &rest, 10);
+      if (*rest == '\0') logs.push_back(log_generation);
+    }
+    ::closedir(listing);
+    std::sort(logs.begin(), logs.end());
+    return logs;
+  }
+
+  void recover()
+  {
+    if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) detail::throw_errno("cannot create " + directory);
+    std::string bytes;
+    std::uint64_t covered = 0;
+    if (detail::read_file(path("checkpoint"), bytes)) covered = load_checkpoint(bytes);
+    generation = covered;
+    std::vector<std::uint64_t> logs = list_logs();
+    for (std::size_t i = 0; i < logs.size(); i++)
+    {
+      std::string name = log_path(logs[i]);
+      if (logs[i] < covered)
+      {
+        ::unlink(name.c_str()); // a crash came between the checkpoint and the cleanup
+        continue;
+      }
+      detail::read_file(name, bytes);
+      std::size_t valid = replay(bytes);
+      if (valid < bytes.size())
+      {
+        if (i + 1 != logs.size()) throw std::runtime_error("corrupt log: " + name);
+        if (::truncate(name.c_str(), static_cast<off_t>(valid)) != 0) detail::throw_errno("cannot truncate " + name);
+      }
+      logged_bytes += valid;
+      generation = logs[i] + 1; // later records go to a fresh log, nothing is appended after a cut
+    }
+  }
+
+  // hands one encoded record to the flusher, waits only if the flusher is far behind
+  void append(RecordType type, const key_type& key, const mapped_type *value)
+  {
+    record.assign(record_header, '\0');
+    record.push_back(static_cast<char>(type));
+    Serializer<key_type>::write(record, key);
+    if (value != nullptr) Serializer<mapped_type>::write(record, *value);
+    std::uint32_t length = static_cast<std::uint32_t>(record.size() - record_header);
+    std::uint32_t crc = detail::crc32c(record.data() + record_header, length);
+    std::memcpy(&record[0], &length, 4);
+    std::memcpy(&record[4], &crc, 4);
+
+    std::unique_lock<std::mutex> guard(lock);
+    check_failure();
+    while (pending_bytes >= options.max_pending_bytes)
+    {
+      urgent = true;
+      work.notify_one();
+      done.wait(guard);
+      check_failure();
+    }
+    bool was_idle = pending.empty();
+    if (was_idle || pending.back().checkpoint || pending.back().generation != generation)
+      pending.push_back(Task{false, generation, std::string(), 0, nullptr});
+    pending.back().bytes += record;
+    pending.back().last_record = ++appended;
+    pending_bytes += record.size();
+    if (was_idle) work.notify_one();
+    guard.unlock();
+    logged_bytes += record.size();
+    reach(DurabilityPoint::record_queued);
+  }
+
+  // called once a logged change is applied, so a checkpoint taken here covers it
+  void checkpoint_if_due()
+  {
+    if (logged_bytes >= options.checkpoint_bytes) start_checkpoint();
+  }
+
+  const Contents* freeze(std::true_type)
+  {
+    return new Contents(map);
+  }
+
+  const Contents* freeze(std::false_type)
+  {
+    return nullptr;
+  }
+
+  // queues a checkpoint of everything logged so far for the flusher, freezing the map if it can
+  // be frozen, later records go to the next log. returns the ticket to wait for
+  std::uint64_t start_checkpoint()
+  {
+    std::unique_ptr<const Contents> contents(freeze(std::integral_constant<bool, Contents::frozen>()));
+    std::lock_guard<std::mutex> guard(lock);
+    check_failure();
+    generation++;
+    pending.push_back(Task{true, generation, std::string(), 0, std::move(contents)});
+    work.notify_one();
+    logged_bytes = 0;
+    return ++checkpoints_started;
+  }
+
+  // checkpoint file: magic, first log not covered, number of entries, the entries and a crc of it all.
+  // the count is filled in by finish_checkpoint
+  static std::string start_checkpoint_file(std::uint64_t covered)
+  {
+    std::string bytes;
+    std::uint32_t magic = checkpoint_magic;
+    Serializer<std::uint32_t>::write(bytes, magic);
+    Serializer<std::uint64_t>::write(bytes, covered);
+    Serializer<std::uint64_t>::write(bytes, std::uint64_t(0));
+    return bytes;
+  }
+
+  static void finish_checkpoint_file(std::string& bytes, std::uint64_t count)
+  {
+    std::memcpy(&bytes[4 + sizeof(std::uint64_t)], &count, sizeof(count));
+    Serializer<std::uint32_t>::write(bytes, detail::crc32c(bytes.data(), bytes.size()));
+  }
+
+  static void write_entry(std::string& bytes, const key_type& key, const mapped_type& value)
+  {
+    Serializer<key_type>::write(bytes, key);
+    Serializer<mapped_type>::write(bytes, value);
+  }
+
+  std::string encode_checkpoint(const Task& task, std::true_type) const
+  {
+    std::string bytes = start_checkpoint_file(task.generation);
+    std::uint64_t count = 0;
+    for (auto it = task.contents->view().begin(); it != task.contents->view().end(); ++it, count++)
+      write_entry(bytes, it->first, it->second);
+    finish_checkpoint_file(bytes, count);
+    return bytes;
+  }
+
+  // the previous checkpoint with the logs written since applied to it, all read back from the files.
+  // only the last change of every key in those logs is held in memory
+  std::string encode_checkpoint(const Task& task, std::false_type) const
+  {
+    struct Change
+    {
+      bool present;
+      mapped_type value;
+
+      Change(): present(false), value() {}
+    };
+    MapType<key_type, Change, 0> changes;
+    std::string previous, log;
+    bool has_previous = detail::read_file(path("checkpoint"), previous);
+    std::uint64_t previous_covered = 0;
+    if (has_previous && previous.size() >= 4 + sizeof(previous_covered))
+      std::memcpy(&previous_covered, previous.data() + 4, sizeof(previous_covered));
+    for (std::uint64_t log_generation : list_logs())
+    {
+      if (log_generation < previous_covered || log_generation >= task.generation) continue;
+      detail::read_file(log_path(log_generation), log);
+      parse_log(log, [&](const key_type& key, mapped_type value)
+                {
+                  Change& change = changes[key];
+                  change.present = true;
+                  change.value = std::move(value);
+                },
+                [&](const key_type& key) { changes[key].present = false; });
+    }
+
+    std::string bytes = start_checkpoint_file(task.generation);
+    std::uint64_t count = 0;
+    if (has_previous)
+      parse_checkpoint(previous, [&](const key_type& key, mapped_type value)
+      {
+        auto it = changes.find(key);
+        if (it == changes.end())
+        {
+          write_entry(bytes, key, value);
+          count++;
+          return;
+        }
+        if (it->second.present)
+        {
+          write_entry(bytes, key, it->second.value);
+          count++;
+        }
+        changes.remove(key);
+      });
+    for (auto it = changes.begin(); it != changes.end(); ++it)
+      if (it->second.present)
+      {
+        write_entry(bytes, it->first, it->second.value);
+        count++;
+      }
+    finish_checkpoint_file(bytes, count);
+    return bytes;
+  }
+
+  // runs on the flusher, the map may be changing meanwhile
+  void write_checkpoint(const Task& task)
+  {
+    std::string bytes = encode_checkpoint(task, std::integral_constant<bool, Contents::frozen>());
+    std::string temporary = path("checkpoint.tmp");
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) detail::throw_errno("cannot create " + temporary);
+    try
+    {
+      detail::write_all(fd, bytes.data(), bytes.size(), temporary);
+      if (options.sync && ::fsync(fd) != 0) detail::throw_errno("cannot sync " + temporary);
+    }
+    catch (...)
+    {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+    reach(DurabilityPoint::checkpoint_written);
+    if (::rename(temporary.c_str(), path("checkpoint").c_str()) != 0) detail::throw_errno("cannot rename " + temporary);
+    if (options.sync) detail::sync_directory(directory);
+    reach(DurabilityPoint::checkpoint_renamed);
+    for (std::uint64_t log_generation : list_logs())
+      if (log_generation < task.generation) ::unlink(log_path(log_generation).c_str());
+  }
+
+  void flush_loop()
+  {
+    int fd = -1;
+    std::uint64_t open_generation = 0;
+    bool dirty = false;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+      work.wait(guard, [&] { return stopping || !pending.empty(); });
+      // group commit: give more records the chance to join the same sync
+      work.wait_for(guard, options.commit_interval, [&] { return stopping || urgent; });
+      if (pending.empty())
+      {
+        if (stopping) break;
+        continue;
+      }
+      std::deque<Task> batch;
+      batch.swap(pending);
+      pending_bytes = 0;
+      urgent = false;
+      guard.unlock();
+
+      std::uint64_t written = 0, checkpoints = 0;
+      std::string error;
+      try
+      {
+        for (const Task& task : batch)
+        {
+          if (fd >= 0 && open_generation != task.generation)
+          {
+            if (dirty && options.sync) detail::sync_file(fd, log_path(open_generation));
+            ::close(fd);
+            fd = -1;
+            dirty = false;
+          }
+          if (task.checkpoint)
+          {
+            write_checkpoint(task);
+            checkpoints++;
+            continue;
+          }
+          if (fd < 0)
+          {
+            open_generation = task.generation;
+            fd = ::open(log_path(open_generation).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd < 0) detail::throw_errno("cannot open " + log_path(open_generation));
+            if (options.sync) detail::sync_directory(directory);
+          }
+          detail::write_all(fd, task.bytes.data(), task.bytes.size(), log_path(open_generation));
+          dirty = true;
+          written = task.last_record;
+          reach(DurabilityPoint::log_written);
+        }
+        if (dirty && options.sync) detail::sync_file(fd, log_path(open_generation));
+        dirty = false;
+      }
+      catch (const std::exception& e)
+      {
+        error = e.what();
+      }
+      batch.clear(); // checkpoint contents are freed before writers are held up by the lock
+
+      guard.lock();
+      if (!error.empty() && failure.empty()) failure = error;
+      if (error.empty() && written > durable) durable = written;
+      checkpoints_done += checkpoints;
+      done.notify_all();
+    }
+    if (fd >= 0) ::close(fd);
+  }
+
+public:
+  explicit DurableMap(const std::string& directory, DurabilityOptions options = DurabilityOptions()):
+    map(), directory(directory), options(options), generation(0), logged_bytes(0), pending_bytes(0),
+    appended(0), durable(0), checkpoints_started(0), checkpoints_done(0), urgent(false), stopping(false)
+  {
+    recover();
+    flusher = std::thread([this] { flush_loop(); });
+  }
+
+  DurableMap(const DurableMap&) = delete;
+  DurableMap& operator=(const DurableMap&) = delete;
+
+  // writes out what is still buffered, errors can no longer be reported here
+  ~DurableMap()
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+      work.notify_one();
+    }
+    flusher.join();
+  }
+
+  void put(const key_type& key, mapped_type value)
+  {
+    append(put_record, key, &value);
+    map[key] = std::move(value);
+    checkpoint_if_due();
+  }
+
+  // durable[key] = value logs like put, reading through it works only for present keys
+  Assignment operator[](const key_type& key)
+  {
+    return Assignment(*this, key);
+  }
+
+  // inserts a value built from args unless the key is present, returns true if it was inserted
+  template <typename... Args>
+  bool emplace(const key_type& key, Args&&... args)
+  {
+    if (contains(key)) return false;
+    put(key, mapped_type(std::forward<Args>(args)...));
+    return true;
+  }
+
+  void remove(const key_type& key)
+  {
+    if (!contains(key)) throw std::out_of_range("such key doesn't exist");
+    append(remove_record, key, nullptr);
+    map.remove(key);
+    checkpoint_if_due();
+  }
+
+  bool contains(const key_type& key) const
+  {
+    return map.find(key) != map.end();
+  }
+
+  const mapped_type& valueOf(const key_type& key) const
+  {
+    return map.valueOf(key);
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    return map.find(key);
+  }
+
+  size_type getSize() const
+  {
+    return map.getSize();
+  }
+
+  bool isEmpty() const
+  {
+    return map.isEmpty();
+  }
+
+  // read-only access to the map itself, changes have to go through this class to be logged
+  const Map& view() const
+  {
+    return map;
+  }
+
+  const_iterator begin() const
+  {
+    return map.begin();
+  }
+
+  const_iterator end() const
+  {
+    return map.end();
+  }
+
+  // waits until every change made so far is on disk
+  void flush()
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    std::uint64_t target = appended;
+    urgent = true;
+    work.notify_one();
+    done.wait(guard, [&] { return durable >= target || !failure.empty(); });
+    check_failure();
+  }
+
+  // writes the whole map as a checkpoint and drops the logs it covers, waits until done
+  void checkpoint()
+  {
+    std::uint64_t ticket = start_checkpoint();
+    std::unique_lock<std::mutex> guard(lock);
+    urgent = true;
+    work.notify_one();
+    done.wait(guard, [&] { return checkpoints_done >= ticket || !failure.empty(); });
+    check_failure();
+  }
+};
+
+template <typename KeyType, typename ValueType, template <typename, typename, std::size_t> class MapType>
+class DurableMap<KeyType, ValueType, MapType>::Assignment
+{
+  friend class DurableMap;
+private:
+  DurableMap& map;
+  key_type key;
+
+  Assignment(DurableMap& map, const key_type& key): map(map), key(key) {}
+public:
+  Assignment& operator=(mapped_type value)
+  {
+    map.put(key, std::move(value));
+    return *this;
+  }
+
+  Assignment& operator=(const Assignment& other)
+  {
+    return *this = static_cast<const mapped_type&>(other);
+  }
+
+  operator const mapped_type&() const
+  {
+    return map.valueOf(key);
+  }
+};
+
+}
+
+#endif /* AISDI_MAPS_DURABLEMAP_H */
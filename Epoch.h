@@ -0,0 +1,172 @@
+#ifndef AISDI_MAPS_EPOCH_H
+#define AISDI_MAPS_EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace aisdi
+{
+namespace detail
+{
+
+// epoch based reclamation for lock-free structures. a thread pins the current epoch while it
+// holds pointers into a shared structure, and memory unlinked from the structure is retired
+// instead of freed. the global epoch moves on only when every pinned thread has seen it, so
+// memory retired in epoch e is freed once the epoch reaches e + 2: by then no thread pinned
+// before the unlink can still be running. pins nest and are per thread
+class EpochDomain
+{
+  struct Retired
+  {
+    void *pointer;
+    void (*deleter)(void*);
+    std::uint64_t epoch;
+  };
+
+  struct Record
+  {
+    std::atomic<std::uint64_t> state; // (epoch << 1) | 1 while pinned, 0 otherwise
+    std::atomic<bool> taken; // owned by a live thread
+    Record *next; // records are never unlinked, so the list can be walked without care
+    unsigned depth; // nested pins of the owning thread
+    std::vector<Retired> retired;
+
+    Record(): state(0), taken(true), next(nullptr), depth(0) {}
+  };
+
+  // gives the record back when its thread ends, memory still retired there is freed by the next owner
+  struct Owner
+  {
+    Record *record;
+
+    Owner(): record(nullptr) {}
+
+    ~Owner()
+    {
+      if (record == nullptr) return;
+      global().collect(*record);
+      record->taken.store(false, std::memory_order_release);
+    }
+  };
+
+  static constexpr std::size_t collect_every = 64; // retirements between attempts to free memory
+
+  std::atomic<std::uint64_t> epoch;
+  std::atomic<Record*> records;
+
+  EpochDomain(): epoch(0), records(nullptr) {}
+
+  Record& acquire()
+  {
+    for (Record *record = records.load(std::memory_order_acquire); record != nullptr; record = record->next)
+    {
+      bool expected = false;
+      if (!record->taken.load(std::memory_order_relaxed) &&
+          record->taken.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        return *record;
+    }
+    Record *record = new Record();
+    Record *head = records.load(std::memory_order_relaxed);
+    do record->next = head;
+    while (!records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+    return *record;
+  }
+
+  Record& local()
+  {
+    static thread_local Owner owner;
+    if (owner.record == nullptr) owner.record = &acquire();
+    return *owner.record;
+  }
+
+  // moves the epoch on if every pinned thread has already seen the current one
+  void try_advance()
+  {
+    std::uint64_t current = epoch.load(std::memory_order_seq_cst);
+    for (Record *record = records.load(std::memory_order_acquire); record != nullptr; record = record->next)
+    {
+      std::uint64_t state = record->state.load(std::memory_order_seq_cst);
+      if ((state & 1) != 0 && (state >> 1) != current) return;
+    }
+    epoch.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst);
+  }
+
+  void collect(Record& record)
+  {
+    try_advance();
+    std::uint64_t current = epoch.load(std::memory_order_seq_cst);
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < record.retired.size(); i++)
+    {
+      Retired& item = record.retired[i];
+      if (item.epoch + 2 <= current) item.deleter(item.pointer);
+      else record.retired[kept++] = item;
+    }
+    record.retired.resize(kept);
+  }
+
+public:
+  EpochDomain(const EpochDomain&) = delete;
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  // shared by all structures, never destroyed so threads ending after main can still let go
+  static EpochDomain& global()
+  {
+    static EpochDomain *domain = new EpochDomain();
+    return *domain;
+  }
+
+  void pin()
+  {
+    Record& record = local();
+    if (record.depth++ != 0) return;
+    // a stale epoch here only holds the global one back, it never lets memory go too early
+    record.state.store((epoch.load(std::memory_order_seq_cst) << 1) | 1, std::memory_order_seq_cst);
+  }
+
+  void unpin()
+  {
+    Record& record = local();
+    if (--record.depth == 0) record.state.store(0, std::memory_order_release);
+  }
+
+  // pointer must already be unreachable for threads that pin from now on
+  void retire(void *pointer, void (*deleter)(void*))
+  {
+    Record& record = local();
+    record.retired.push_back(Retired{pointer, deleter, epoch.load(std::memory_order_seq_cst)});
+    if (record.retired.size() % collect_every == 0) collect(record);
+  }
+};
+
+// keeps the calling thread pinned for its lifetime, must not cross threads
+class EpochGuard
+{
+public:
+  EpochGuard()
+  {
+    EpochDomain::global().pin();
+  }
+
+  EpochGuard(const EpochGuard&)
+  {
+    EpochDomain::global().pin();
+  }
+
+  EpochGuard& operator=(const EpochGuard&)
+  {
+    return *this;
+  }
+
+  ~EpochGuard()
+  {
+    EpochDomain::global().unpin();
+  }
+};
+
+}
+}
+
+#endif /* AISDI_MAPS_EPOCH_H */
@@ -0,0 +1,300 @@
+#ifndef AISDI_MAPS_EXPIRINGMAP_H
+#define AISDI_MAPS_EXPIRINGMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "HashMap.h"
+
+namespace aisdi
+{
+
+// map whose entries live for a given number of ticks. expiry times are kept in a hierarchical
+// timer wheel: level l has wheel_slots slots of wheel_slots^l ticks each, and a slot of an upper
+// level is spread over the level below when the wheel reaches it. advance(now) reclaims what
+// expired so far, its cost is proportional to the timers it passes, not to the size of the map,
+// and empty stretches of the wheel are skipped using per level occupancy masks.
+// lookups treat an entry whose time has come as absent even before advance reaches it.
+// works over HashMap or TreeMap (any map with find, operator[] and remove), kept without inline storage
+template <typename KeyType, typename ValueType, template <typename, typename, std::size_t> class MapType = HashMap>
+class ExpiringMap
+{
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using size_type = std::size_t;
+  using tick_type = std::uint64_t;
+
+  static constexpr int wheel_bits = 6;
+  static constexpr int wheel_slots = 1 << wheel_bits;
+  static constexpr int wheel_levels = 4; // timers further than wheel_slots^4 ticks wait in the top level
+
+private:
+  struct Entry
+  {
+    mapped_type value;
+    tick_type expires_at;
+    tick_type timer_at; // expiry of the timer filed for the entry, 0 when there is none yet
+
+    Entry(): value(), expires_at(0), timer_at(0) {}
+  };
+
+  // an entry has one timer. a later expiry only updates the entry and the timer files itself
+  // again when it fires, an earlier one files a new timer. timers are never searched for:
+  // one that fires for an entry removed or with another timer since it was filed is dropped
+  struct Timer
+  {
+    key_type key;
+    tick_type expires_at;
+  };
+
+  using Map = MapType<KeyType, Entry, 0>;
+
+  Map entries;
+  std::vector<Timer> wheel[wheel_levels][wheel_slots];
+  std::uint64_t occupied[wheel_levels]; // bit s is set when wheel[level][s] holds timers
+  tick_type current; // present tick, the wheel has handled every tick up to it
+  size_type pending; // timers in the wheel
+
+  static int lowest_bit(std::uint64_t bits)
+  {
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int bit = 0;
+    while ((bits & 1) == 0)
+    {
+      bits >>= 1;
+      bit++;
+    }
+    return bit;
+#endif
+  }
+
+  static int level_of(tick_type delta)
+  {
+    int level = 0;
+    while (level < wheel_levels - 1 && delta >= (tick_type(1) << (wheel_bits * (level + 1)))) level++;
+    return level;
+  }
+
+  // files a timer relative to base, the first tick not handled yet
+  void schedule(const key_type& key, tick_type expires_at, tick_type base)
+  {
+    tick_type due = expires_at < base ? base : expires_at;
+    tick_type top = base + (tick_type(1) << (wheel_bits * wheel_levels)) - 1;
+    if (due > top) due = top; // fires early and is scheduled again
+    int level = level_of(due - base);
+    int slot = static_cast<int>((due >> (wheel_bits * level)) & (wheel_slots - 1));
+    wheel[level][slot].push_back(Timer{key, expires_at});
+    occupied[level] |= std::uint64_t(1) << slot;
+    pending++;
+  }
+
+  // takes the timers out of a slot
+  void empty_slot(int level, int slot, std::vector<Timer>& out)
+  {
+    out.swap(wheel[level][slot]);
+    occupied[level] &= ~(std::uint64_t(1) << slot);
+    pending -= out.size();
+  }
+
+  // first tick after current at which a slot fires or cascades, skipping stretches where the
+  // wheel is empty. must only be called with timers pending
+  tick_type next_event() const
+  {
+    for (int level = 0; level < wheel_levels; level++)
+    {
+      int shift = wheel_bits * level;
+      int slot = static_cast<int>((current >> shift) & (wheel_slots - 1));
+      std::uint64_t later = slot == wheel_slots - 1 ? 0 : occupied[level] & (~std::uint64_t(0) << (slot + 1));
+      tick_type round = (current >> (shift + wheel_bits)) << (shift + wheel_bits);
+      if (later != 0) return round + (tick_type(lowest_bit(later)) << shift);
+      // timers left in this level come round again after the next boundary of the level above
+      if (occupied[level] != 0) return round + (tick_type(1) << (shift + wheel_bits));
+    }
+    return current + 1;
+  }
+
+  // spreads the upper level slots that start at current over the levels below
+  void cascade()
+  {
+    std::vector<Timer> moved;
+    for (int level = 1; level < wheel_levels; level++)
+    {
+      int slot = static_cast<int>((current >> (wheel_bits * level)) & (wheel_slots - 1));
+      empty_slot(level, slot, moved);
+      for (const Timer& timer : moved) schedule(timer.key, timer.expires_at, current);
+      moved.clear();
+      if (slot != 0) break;
+    }
+  }
+
+  // files the timer of entry unless the one it has fires no later than the new expiry
+  void expire_at(const key_type& key, Entry& entry, tick_type expires_at)
+  {
+    entry.expires_at = expires_at;
+    if (entry.timer_at != 0 && entry.timer_at <= expires_at) return;
+    entry.timer_at = expires_at;
+    schedule(key, expires_at, current + 1);
+  }
+
+  // handles the timers due at current, returns the number of entries removed
+  size_type fire()
+  {
+    size_type expired = 0;
+    std::vector<Timer> due;
+    empty_slot(0, static_cast<int>(current & (wheel_slots - 1)), due);
+    for (const Timer& timer : due)
+    {
+      if (timer.expires_at > current)
+      {
+        schedule(timer.key, timer.expires_at, current + 1);
+        continue;
+      }
+      auto it = entries.find(timer.key);
+      if (it == entries.end() || it->second.timer_at != timer.expires_at) continue;
+      Entry& entry = it->second;
+      if (alive(entry))
+      {
+        entry.timer_at = entry.expires_at;
+        schedule(timer.key, entry.expires_at, current + 1);
+        continue;
+      }
+      entries.remove(it);
+      expired++;
+    }
+    due.clear();
+    if (wheel[0][current & (wheel_slots - 1)].empty()) due.swap(wheel[0][current & (wheel_slots - 1)]);
+    return expired;
+  }
+
+  bool alive(const Entry& entry) const
+  {
+    return entry.expires_at > current;
+  }
+
+public:
+  explicit ExpiringMap(tick_type now = 0): occupied(), current(now), pending(0) {}
+
+  tick_type now() const
+  {
+    return current;
+  }
+
+  // inserts or replaces the value, it stays for ttl ticks: until advance() passes now() + ttl - 1.
+  // a ttl of 0 removes the key
+  void put(const key_type& key, mapped_type value, tick_type ttl)
+  {
+    if (ttl == 0)
+    {
+      auto it = entries.find(key);
+      if (it != entries.end()) entries.remove(it);
+      return;
+    }
+    Entry& entry = entries[key];
+    entry.value = std::move(value);
+    expire_at(key, entry, current + ttl);
+  }
+
+  // gives a live entry a new time to live, returns false if there is none
+  bool refresh(const key_type& key, tick_type ttl)
+  {
+    auto it = entries.find(key);
+    if (it == entries.end() || !alive(it->second)) return false;
+    if (ttl == 0)
+    {
+      entries.remove(it);
+      return true;
+    }
+    expire_at(key, it->second, current + ttl);
+    return true;
+  }
+
+  // returns the value or nullptr if the key is absent or expired, an expired entry is removed
+  mapped_type* get(const key_type& key)
+  {
+    auto it = entries.find(key);
+    if (it == entries.end()) return nullptr;
+    if (!alive(it->second))
+    {
+      entries.remove(it);
+      return nullptr;
+    }
+    return &it->second.value;
+  }
+
+  bool contains(const key_type& key) const
+  {
+    auto it = entries.find(key);
+    return it != entries.end() && alive(it->second);
+  }
+
+  const mapped_type& valueOf(const key_type& key) const
+  {
+    auto it = entries.find(key);
+    if (it == entries.end() || !alive(it->second)) throw std::out_of_range("such key doesn't exist");
+    return it->second.value;
+  }
+
+  // ticks left for a live key
+  tick_type ttl(const key_type& key) const
+  {
+    auto it = entries.find(key);
+    if (it == entries.end() || !alive(it->second)) throw std::out_of_range("such key doesn't exist");
+    return it->second.expires_at - current;
+  }
+
+  void remove(const key_type& key)
+  {
+    auto it = entries.find(key);
+    if (it == entries.end() || !alive(it->second)) throw std::out_of_range("such key doesn't exist");
+    entries.remove(it);
+  }
+
+  // moves the clock to now and removes every entry that expired by then, returns their number
+  size_type advance(tick_type now)
+  {
+    size_type expired = 0;
+    while (current < now)
+    {
+      tick_type next = pending == 0 ? now + 1 : next_event();
+      if (next > now)
+      {
+        current = now;
+        break;
+      }
+      current = next;
+      if ((current & (wheel_slots - 1)) == 0) cascade();
+      expired += fire();
+    }
+    return expired;
+  }
+
+  bool isEmpty() const
+  {
+    return entries.isEmpty();
+  }
+
+  // entries not reclaimed yet, after advance(now) only live ones
+  size_type getSize() const
+  {
+    return entries.getSize();
+  }
+
+  void clear()
+  {
+    entries = Map();
+    for (auto& level : wheel)
+      for (auto& slot : level) std::vector<Timer>().swap(slot);
+    for (auto& bits : occupied) bits = 0;
+    pending = 0;
+  }
+};
+
+}
+
+#endif /* AISDI_MAPS_EXPIRINGMAP_H */
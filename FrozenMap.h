@@ -0,0 +1,548 @@
+#ifndef AISDI_MAPS_FROZENMAP_H
+#define AISDI_MAPS_FROZENMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "HashMap.h"
+#include "TreeMap.h"
+
+namespace aisdi
+{
+
+// read-only copy of a HashMap. keys are placed by a minimal perfect hash built with
+// hash-and-displace (CHD): keys are grouped in buckets, and every bucket gets a displacement
+// that sends all its keys to free slots. the search runs over slightly more slots than keys,
+// which keeps it linear, and the few keys landing past the last entry are sent through a
+// remap table to the slots left free. lookup is one hash, one mix and one key comparison.
+// keys whose std::hash values are equal cannot be told apart by any displacement, so all but
+// one of each such group are kept after the placed entries, sorted by hash, and searched
+// only when the slot holds another key
+template <typename KeyType, typename ValueType>
+class FrozenHashMap
+{
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using value_type = std::pair<const key_type, mapped_type>;
+  using size_type = std::size_t;
+  using const_reference = const value_type&;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+  using ConstIterator = const_iterator;
+
+  static constexpr std::size_t keys_per_bucket = 2;
+  static constexpr std::size_t max_attempts = 16; // seeds tried before freezing gives up
+  // mix(0) is 0, which pins a key to one slot whatever its displacement, so the usual hash
+  // of 0 must not meet a seed of 0
+  static constexpr std::uint64_t initial_seed = 0x9e3779b97f4a7c15ULL;
+
+private:
+  std::vector<value_type> entries; // placed entries by slot, then the ones with shared hashes
+  std::vector<std::uint32_t> displacement; // one per bucket
+  std::vector<std::size_t> remap; // slot for each of the slots past placed
+  std::vector<std::uint64_t> shared_hashes; // hashes of the entries after placed
+  std::uint64_t seed;
+  std::size_t slot_count; // slots the displacements are searched over, a bit over placed
+  std::size_t placed; // entries reached through the perfect hash
+
+  static std::uint64_t mix(std::uint64_t value)
+  {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+  }
+
+  // bucket and both slot hashes come from one mixed value
+  std::uint64_t mixed(std::uint64_t hash_code) const
+  {
+    return mix(hash_code ^ seed);
+  }
+
+  // maps a 64 bit value onto [0, range) with a multiply instead of a division, the high half
+  // of the 128 bit product. every slot stays reachable however many keys there are
+  static std::size_t reduce(std::uint64_t value, std::uint64_t range)
+  {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 wide;
+    return static_cast<std::size_t>((static_cast<wide>(value) * range) >> 64);
+#else
+    std::uint64_t value_low = value & 0xffffffffULL, value_high = value >> 32;
+    std::uint64_t range_low = range & 0xffffffffULL, range_high = range >> 32;
+    std::uint64_t middle = (value_low * range_low >> 32) + (value_high * range_low & 0xffffffffULL) + value_low * range_high;
+    return static_cast<std::size_t>(value_high * range_high + (value_high * range_low >> 32) + (middle >> 32));
+#endif
+  }
+
+  // the bucket comes from the top bits of the mixed hash, which the slot hashes spread again
+  std::size_t bucket_of(std::uint64_t mixed_hash) const
+  {
+    return reduce(mixed_hash, displacement.size());
+  }
+
+  // slot for f1 + shift * f2, both taken from the mixed hash
+  std::size_t slot_of(std::uint64_t mixed_hash, std::uint32_t shift) const
+  {
+    std::uint64_t first = mixed_hash * 0x9e3779b97f4a7c15ULL;
+    std::uint64_t second = (((mixed_hash << 32) | (mixed_hash >> 32)) * 0xc2b2ae3d27d4eb4fULL) | 1;
+    return reduce(first + shift * second, slot_count);
+  }
+
+  // members of every bucket stored one bucket after another, members of bucket b are
+  // members[first[b], first[b + 1])
+  void group(const std::vector<std::uint64_t>& mixed_hashes, std::vector<std::size_t>& first, std::vector<std::size_t>& members) const
+  {
+    first.assign(displacement.size() + 1, 0);
+    for (std::uint64_t mixed_hash : mixed_hashes) first[bucket_of(mixed_hash) + 1]++;
+    for (std::size_t bucket = 0; bucket < displacement.size(); bucket++) first[bucket + 1] += first[bucket];
+    std::vector<std::size_t> cursor(first.begin(), first.end() - 1);
+    members.resize(mixed_hashes.size());
+    for (std::size_t i = 0; i < mixed_hashes.size(); i++) members[cursor[bucket_of(mixed_hashes[i])]++] = i;
+  }
+
+  // assigns a slot to every hash, returns false if some bucket found no displacement
+  bool place(const std::vector<std::uint64_t>& mixed_hashes, std::vector<std::size_t>& slot_owner)
+  {
+    std::size_t count = mixed_hashes.size(), buckets = displacement.size();
+    std::vector<std::size_t> first, members;
+    group(mixed_hashes, first, members);
+
+    // the fullest buckets are placed first, while most slots are still free. sizes are
+    // small, so buckets are ordered by a counting sort
+    std::size_t largest = 0;
+    for (std::size_t bucket = 0; bucket < buckets; bucket++)
+      largest = std::max(largest, first[bucket + 1] - first[bucket]);
+    std::vector<std::size_t> by_size(largest + 2, 0), order(buckets);
+    for (std::size_t bucket = 0; bucket < buckets; bucket++) by_size[largest - (first[bucket + 1] - first[bucket]) + 1]++;
+    for (std::size_t size = 0; size <= largest; size++) by_size[size + 1] += by_size[size];
+    for (std::size_t bucket = 0; bucket < buckets; bucket++)
+      order[by_size[largest - (first[bucket + 1] - first[bucket])]++] = bucket;
+
+    // the search probes a bit per slot, which stays in cache far longer than the owners
+    std::vector<std::uint64_t> used((slot_count + 63) / 64, 0);
+    slot_owner.assign(slot_count, count);
+    std::vector<std::size_t> taken;
+    const std::uint32_t max_shift = 1u << 16;
+    for (std::size_t bucket : order)
+    {
+      if (first[bucket] == first[bucket + 1]) break;
+      std::uint32_t shift = 0;
+      for (; shift < max_shift; shift++)
+      {
+        taken.clear();
+        bool fits = true;
+        for (std::size_t member = first[bucket]; member < first[bucket + 1]; member++)
+        {
+          std::size_t slot = slot_of(mixed_hashes[members[member]], shift);
+          std::uint64_t bit = std::uint64_t(1) << (slot & 63);
+          if (used[slot >> 6] & bit) { fits = false; break; }
+          used[slot >> 6] |= bit;
+          taken.push_back(slot);
+        }
+        if (fits) break;
+        for (std::size_t slot : taken) used[slot >> 6] &= ~(std::uint64_t(1) << (slot & 63));
+      }
+      if (shift == max_shift) return false;
+      displacement[bucket] = shift;
+      for (std::size_t member = first[bucket]; member < first[bucket + 1]; member++)
+        slot_owner[taken[member - first[bucket]]] = members[member];
+    }
+    return true;
+  }
+
+  // moves all but one of every group of equal hashes to the end of items and hashes,
+  // returns how many are left in front. equal hashes always share a bucket, so they are
+  // found by grouping and comparing within the (small) buckets
+  std::size_t split_shared(std::vector<const value_type*>& items, std::vector<std::uint64_t>& hashes)
+  {
+    std::size_t count = hashes.size();
+    std::vector<std::uint64_t> mixed_hashes(count);
+    for (std::size_t i = 0; i < count; i++) mixed_hashes[i] = mixed(hashes[i]);
+    std::vector<std::size_t> first, members;
+    group(mixed_hashes, first, members);
+    std::vector<bool> shared(count, false);
+    bool any = false;
+    for (std::size_t bucket = 0; bucket < displacement.size(); bucket++)
+      for (std::size_t i = first[bucket]; i < first[bucket + 1]; i++)
+        for (std::size_t j = first[bucket]; j < i; j++)
+          if (hashes[members[i]] == hashes[members[j]])
+          {
+            shared[members[i]] = any = true;
+            break;
+          }
+    if (!any) return count;
+
+    std::vector<std::pair<std::uint64_t, const value_type*>> aside;
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+      if (shared[i]) aside.emplace_back(hashes[i], items[i]);
+      else
+      {
+        hashes[kept] = hashes[i];
+        items[kept++] = items[i];
+      }
+    }
+    std::sort(aside.begin(), aside.end(), [](const std::pair<std::uint64_t, const value_type*>& left, const std::pair<std::uint64_t, const value_type*>& right)
+    {
+      return left.first < right.first;
+    });
+    for (std::size_t i = 0; i < aside.size(); i++)
+    {
+      hashes[kept + i] = aside[i].first;
+      items[kept + i] = aside[i].second;
+    }
+    return kept;
+  }
+
+  const_iterator find_shared(std::uint64_t hash_code, const key_type& key) const
+  {
+    auto it = std::lower_bound(shared_hashes.begin(), shared_hashes.end(), hash_code);
+    for (; it != shared_hashes.end() && *it == hash_code; ++it)
+    {
+      const_iterator entry = entries.begin() + placed + (it - shared_hashes.begin());
+      if (entry->first == key) return entry;
+    }
+    return end();
+  }
+
+public:
+  FrozenHashMap(): seed(0), slot_count(0), placed(0) {}
+
+  // throws std::runtime_error in the unlikely case that no seed yields a perfect hash
+  template <std::size_t InlineCapacity>
+  explicit FrozenHashMap(const HashMap<KeyType, ValueType, InlineCapacity>& source): seed(initial_seed), slot_count(0), placed(0)
+  {
+    std::size_t count = source.getSize();
+    if (count == 0) return;
+    std::vector<const value_type*> items;
+    std::vector<std::uint64_t> hashes;
+    items.reserve(count);
+    hashes.reserve(count);
+    for (auto it = source.begin(); it != source.end(); ++it)
+    {
+      items.push_back(&*it);
+      hashes.push_back(std::hash<key_type>{}(it->first));
+    }
+
+    displacement.assign(count / keys_per_bucket + 1, 0); // split_shared groups by bucket too
+    placed = split_shared(items, hashes);
+    shared_hashes.assign(hashes.begin() + placed, hashes.end());
+    hashes.resize(placed);
+    displacement.assign(placed / keys_per_bucket + 1, 0);
+    slot_count = placed + placed / 50 + 1; // 98% load
+
+    std::vector<std::size_t> slot_owner;
+    std::vector<std::uint64_t> mixed_hashes(placed);
+    std::size_t attempt = 0;
+    while (true)
+    {
+      for (std::size_t i = 0; i < placed; i++) mixed_hashes[i] = mixed(hashes[i]);
+      if (place(mixed_hashes, slot_owner)) break;
+      if (++attempt == max_attempts) throw std::runtime_error("no perfect hash found for these keys");
+      seed = mix(seed + 1);
+    }
+
+    // keys beyond the last entry go to the free slots in front, in order
+    remap.assign(slot_count - placed, 0);
+    std::size_t free_slot = 0;
+    for (std::size_t slot = placed; slot < slot_count; slot++)
+    {
+      if (slot_owner[slot] == placed) continue;
+      while (slot_owner[free_slot] != placed) free_slot++;
+      slot_owner[free_slot] = slot_owner[slot];
+      remap[slot - placed] = free_slot;
+    }
+    entries.reserve(count);
+    for (std::size_t slot = 0; slot < placed; slot++)
+      entries.emplace_back(*items[slot_owner[slot]]);
+    for (std::size_t i = placed; i < count; i++)
+      entries.emplace_back(*items[i]);
+  }
+
+  bool isEmpty() const
+  {
+    return entries.empty();
+  }
+
+  size_type getSize() const
+  {
+    return entries.size();
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    if (entries.empty()) return end();
+    std::uint64_t hash_code = std::hash<key_type>{}(key);
+    std::uint64_t mixed_hash = mixed(hash_code);
+    std::size_t slot = slot_of(mixed_hash, displacement[bucket_of(mixed_hash)]);
+    if (slot >= placed) slot = remap[slot - placed];
+    if (entries[slot].first == key) return entries.begin() + slot;
+    if (shared_hashes.empty()) return end();
+    return find_shared(hash_code, key);
+  }
+
+  const mapped_type& valueOf(const key_type& key) const
+  {
+    const_iterator it = find(key);
+    if (it == end()) throw std::out_of_range("such key doesn't exist");
+    return it->second;
+  }
+
+  const_iterator begin() const
+  {
+    return entries.begin();
+  }
+
+  const_iterator end() const
+  {
+    return entries.end();
+  }
+
+  const_iterator cbegin() const
+  {
+    return begin();
+  }
+
+  const_iterator cend() const
+  {
+    return end();
+  }
+};
+
+// read-only copy of a TreeMap kept in one array in Eytzinger (BFS) order: the children of
+// the element at position k are at 2k and 2k + 1 (counting from 1). the search has no
+// data dependent branches and prefetches the subtree four levels down
+template <typename KeyType, typename ValueType>
+class FrozenTreeMap
+{
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using value_type = std::pair<const key_type, mapped_type>;
+  using size_type = std::size_t;
+  using const_reference = const value_type&;
+
+  class ConstIterator;
+  using const_iterator = ConstIterator;
+
+private:
+  std::vector<value_type> layout; // position k is stored at layout[k - 1]
+
+  // visits positions in order, handing out consecutive sorted indexes
+  static void number(std::size_t position, std::size_t count, std::size_t& next, std::vector<std::size_t>& sorted_index)
+  {
+    if (position > count) return;
+    number(2 * position, count, next, sorted_index);
+    sorted_index[position - 1] = next++;
+    number(2 * position + 1, count, next, sorted_index);
+  }
+
+  // position of the first element not lower than key, 0 if there is none
+  std::size_t lower_position(const key_type& key) const
+  {
+    std::size_t count = layout.size(), position = 1;
+    const value_type *data = layout.data();
+    while (position <= count)
+    {
+#if defined(__GNUC__)
+      std::size_t ahead = 16 * position;
+      if (ahead <= count) __builtin_prefetch(data + ahead - 1);
+#endif
+      position = 2 * position + (key > data[position - 1].first);
+    }
+    // drop the trailing right turns and the final left turn
+    while (position & 1) position >>= 1;
+    return position >> 1;
+  }
+
+public:
+  FrozenTreeMap() {}
+
+  template <std::size_t InlineCapacity>
+  explicit FrozenTreeMap(const TreeMap<KeyType, ValueType, InlineCapacity>& source)
+  {
+    std::size_t count = source.getSize();
+    std::vector<const value_type*> sorted;
+    sorted.reserve(count);
+    for (auto it = source.begin(); it != source.end(); ++it)
+      sorted.push_back(&*it);
+
+    std::vector<std::size_t> sorted_index(count);
+    std::size_t next = 0;
+    number(1, count, next, sorted_index);
+    layout.reserve(count);
+    for (std::size_t position = 0; position < count; position++)
+      layout.emplace_back(*sorted[sorted_index[position]]);
+  }
+
+  bool isEmpty() const
+  {
+    return layout.empty();
+  }
+
+  size_type getSize() const
+  {
+    return layout.size();
+  }
+
+  const_iterator lower_bound(const key_type& key) const
+  {
+    return ConstIterator(this, lower_position(key));
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    std::size_t position = lower_position(key);
+    if (position == 0 || layout[position - 1].first != key) return end();
+    return ConstIterator(this, position);
+  }
+
+  const mapped_type& valueOf(const key_type& key) const
+  {
+    const_iterator it = find(key);
+    if (it == end()) throw std::out_of_range("such key doesn't exist");
+    return it->second;
+  }
+
+  const_iterator begin() const
+  {
+    if (layout.empty()) return end();
+    std::size_t position = 1;
+    while (2 * position <= layout.size()) position *= 2;
+    return ConstIterator(this, position);
+  }
+
+  const_iterator end() const
+  {
+    return ConstIterator(this, 0);
+  }
+
+  const_iterator cbegin() const
+  {
+    return begin();
+  }
+
+  const_iterator cend() const
+  {
+    return end();
+  }
+};
+
+template <typename KeyType, typename ValueType>
+class FrozenTreeMap<KeyType, ValueType>::ConstIterator
+{
+  friend class FrozenTreeMap;
+public:
+  using reference = typename FrozenTreeMap::const_reference;
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = typename FrozenTreeMap::value_type;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const typename FrozenTreeMap::value_type*;
+
+private:
+  const FrozenTreeMap *tmap;
+  std::size_t position; // 0 is end
+
+  ConstIterator(const FrozenTreeMap *tmap, std::size_t position): tmap(tmap), position(position) {}
+public:
+  ConstIterator(): tmap(nullptr), position(0) {}
+
+  ConstIterator& operator++()
+  {
+    std::size_t count = tmap->layout.size();
+    if (position == 0) throw std::out_of_range("cannot increment end iterator");
+    if (2 * position + 1 <= count)
+    {
+      position = 2 * position + 1;
+      while (2 * position <= count) position *= 2;
+    }
+    else
+    {
+      while (position & 1) position >>= 1;
+      position >>= 1;
+    }
+    return *this;
+  }
+
+  ConstIterator operator++(int)
+  {
+    ConstIterator it(*this);
+    operator++();
+    return it;
+  }
+
+  ConstIterator& operator--()
+  {
+    std::size_t count = tmap->layout.size();
+    if (position == 0)
+    {
+      if (count == 0) throw std::out_of_range("cannot decrement begin iterator");
+      position = 1;
+      while (2 * position + 1 <= count) position = 2 * position + 1;
+    }
+    else if (2 * position <= count)
+    {
+      position = 2 * position;
+      while (2 * position + 1 <= count) position = 2 * position + 1;
+    }
+    else
+    {
+      while (position != 1 && !(position & 1)) position >>= 1;
+      if (position == 1) throw std::out_of_range("cannot decrement begin iterator");
+      position >>= 1;
+    }
+    return *this;
+  }
+
+  ConstIterator operator--(int)
+  {
+    ConstIterator it(*this);
+    operator--();
+    return it;
+  }
+
+  reference operator*() const
+  {
+    if (position == 0) throw std::out_of_range("cannot dereference end iterator");
+    return tmap->layout[position - 1];
+  }
+
+  pointer operator->() const
+  {
+    return &this->operator*();
+  }
+
+  bool operator==(const ConstIterator& other) const
+  {
+    return position == other.position;
+  }
+
+  bool operator!=(const ConstIterator& other) const
+  {
+    return position != other.position;
+  }
+};
+
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+FrozenHashMap<KeyType, ValueType> freeze(const HashMap<KeyType, ValueType, InlineCapacity>& source)
+{
+  return FrozenHashMap<KeyType, ValueType>(source);
+}
+
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+FrozenTreeMap<KeyType, ValueType> freeze(const TreeMap<KeyType, ValueType, InlineCapacity>& source)
+{
+  return FrozenTreeMap<KeyType, ValueType>(source);
+}
+
+}
+
+#endif /* AISDI_MAPS_FROZENMAP_H */
@@ -0,0 +1,264 @@
+#ifndef AISDI_MAPS_HASHCACHE_H
+#define AISDI_MAPS_HASHCACHE_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+#include "HashMap.h"
+
+namespace aisdi
+{
+
+enum class CachePolicy
+{
+  lru,   // evicts the entry used least recently
+  clock  // second chance: a hand sweeps the table and evicts the first entry not used since its last visit
+};
+
+// weight of every entry is 1, so the capacity counts entries
+struct UnitWeigher
+{
+  template <typename KeyType, typename ValueType>
+  std::size_t operator()(const KeyType&, const ValueType&) const
+  {
+    return 1;
+  }
+};
+
+// bounded cache in front of a HashMap. the total weight of the entries never exceeds the capacity,
+// with UnitWeigher that is an entry count, with a weigher returning byte sizes it is a byte budget.
+// recency is tracked inside the map nodes (list links or a reference bit stored next to the value),
+// so get and put allocate nothing besides the node and stay O(1)
+template <typename KeyType, typename ValueType, typename Weigher = UnitWeigher>
+class HashCache
+{
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using size_type = std::size_t;
+
+private:
+  struct Entry;
+  using Map = HashMap<KeyType, Entry>;
+  using Item = typename Map::value_type;
+
+  struct Entry
+  {
+    mapped_type value;
+    size_type weight;
+    Item *newer; // lru list, towards the most recently used entry
+    Item *older;
+    bool referenced; // clock bit
+
+    Entry(): value(), weight(0), newer(nullptr), older(nullptr), referenced(false) {}
+  };
+
+  // nodes keep their addresses for the whole life of the map, so the list can point into them
+  Map entries;
+  CachePolicy policy;
+  Weigher weigher;
+  size_type capacity;
+  size_type weight;
+  Item *newest;
+  Item *oldest;
+  typename Map::iterator hand;
+  size_type hit_count;
+  size_type miss_count;
+  size_type eviction_count;
+
+  void detach(Item *item)
+  {
+    Entry& entry = item->second;
+    if (entry.newer != nullptr) entry.newer->second.older = entry.older;
+    else newest = entry.older;
+    if (entry.older != nullptr) entry.older->second.newer = entry.newer;
+    else oldest = entry.newer;
+    entry.newer = entry.older = nullptr;
+  }
+
+  void push_newest(Item *item)
+  {
+    Entry& entry = item->second;
+    entry.older = newest;
+    entry.newer = nullptr;
+    if (newest != nullptr) newest->second.newer = item;
+    else oldest = item;
+    newest = item;
+  }
+
+  void touch(Item *item)
+  {
+    if (policy == CachePolicy::clock) item->second.referenced = true;
+    else if (item != newest)
+    {
+      detach(item);
+      push_newest(item);
+    }
+  }
+
+  // moves the hand one entry on, wrapping around at the end of the table
+  void advance_hand()
+  {
+    if (hand != entries.end()) ++hand;
+    if (hand == entries.end()) hand = entries.begin();
+  }
+
+  void erase(Item *item)
+  {
+    if (policy == CachePolicy::lru) detach(item);
+    else if (hand != entries.end() && &*hand == item)
+    {
+      advance_hand();
+      if (&*hand == item) hand = entries.end();
+    }
+    weight -= item->second.weight;
+    entries.remove(item->first);
+  }
+
+  Item* victim()
+  {
+    if (policy == CachePolicy::lru) return oldest;
+    if (hand == entries.end()) hand = entries.begin();
+    while (hand->second.referenced)
+    {
+      hand->second.referenced = false;
+      advance_hand();
+    }
+    return &*hand;
+  }
+
+  // evicts until the budget holds, sparing the entry just written
+  void evict(const Item *kept)
+  {
+    while (weight > capacity)
+    {
+      Item *item = victim();
+      if (item == kept)
+      {
+        advance_hand();
+        continue;
+      }
+      erase(item);
+      eviction_count++;
+    }
+  }
+
+public:
+  explicit HashCache(size_type capacity, CachePolicy policy = CachePolicy::lru, Weigher weigher = Weigher()):
+    entries(), policy(policy), weigher(weigher), capacity(capacity),
+    weight(0), newest(nullptr), oldest(nullptr), hand(entries.end()), hit_count(0), miss_count(0), eviction_count(0)
+  {
+    if (capacity == 0) throw std::invalid_argument("cache capacity must be positive");
+  }
+
+  // the recency list points into the nodes of this map, copies would have to rebuild it
+  HashCache(const HashCache&) = delete;
+  HashCache& operator=(const HashCache&) = delete;
+
+  // returns the cached value or nullptr, a hit makes the entry recently used
+  mapped_type* get(const key_type& key)
+  {
+    typename Map::iterator it = entries.find(key);
+    if (it == entries.end())
+    {
+      miss_count++;
+      return nullptr;
+    }
+    hit_count++;
+    touch(&*it);
+    return &it->second.value;
+  }
+
+  // checks for a key without counting a hit or a miss or changing recency
+  bool contains(const key_type& key) const
+  {
+    return entries.find(key) != entries.end();
+  }
+
+  // inserts or replaces the value and evicts entries until the cache is within its capacity.
+  // a value heavier than the whole capacity is not kept
+  void put(const key_type& key, mapped_type value)
+  {
+    size_type new_weight = weigher(key, value);
+    if (new_weight > capacity)
+    {
+      typename Map::iterator it = entries.find(key);
+      if (it != entries.end())
+      {
+        erase(&*it);
+        eviction_count++;
+      }
+      return;
+    }
+    std::pair<typename Map::iterator, bool> placed = entries.try_emplace(key);
+    Item *item = &*placed.first;
+    if (!placed.second)
+    {
+      weight -= item->second.weight;
+      touch(item);
+    }
+    else if (policy == CachePolicy::lru) push_newest(item);
+    else if (hand == entries.end()) hand = placed.first;
+    item->second.value = std::move(value);
+    item->second.weight = new_weight;
+    weight += new_weight;
+    evict(item);
+  }
+
+  void remove(const key_type& key)
+  {
+    typename Map::iterator it = entries.find(key);
+    if (it == entries.end()) throw std::out_of_range("such key doesn't exist");
+    erase(&*it);
+  }
+
+  void clear()
+  {
+    while (!entries.isEmpty()) erase(&*entries.begin());
+  }
+
+  bool isEmpty() const
+  {
+    return entries.isEmpty();
+  }
+
+  size_type getSize() const
+  {
+    return entries.getSize();
+  }
+
+  size_type getWeight() const
+  {
+    return weight;
+  }
+
+  size_type getCapacity() const
+  {
+    return capacity;
+  }
+
+  size_type hits() const
+  {
+    return hit_count;
+  }
+
+  size_type misses() const
+  {
+    return miss_count;
+  }
+
+  size_type evictions() const
+  {
+    return eviction_count;
+  }
+
+  void reset_stats()
+  {
+    hit_count = miss_count = eviction_count = 0;
+  }
+};
+
+}
+
+#endif /* AISDI_MAPS_HASHCACHE_H */
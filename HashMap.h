@@ -1,15 +1,22 @@
 #ifndef AISDI_MAPS_HASHMAP_H
 #define AISDI_MAPS_HASHMAP_H
 
+#include <chrono>
 #include <cstddef>
 #include <initializer_list>
+#include <new>
 #include <stdexcept>
 #include <utility>
+#include <vector>
+#include "InlineSlots.h"
+#include "NodeArena.h"
+#include "PageAllocator.h"
+#include "Parallel.h"
 
 namespace aisdi
 {
 
-template <typename KeyType, typename ValueType>
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity = 0>
 class HashMap
 {
 public:
@@ -22,37 +29,393 @@ public:
 
   class ConstIterator;
   class Iterator;
+  class NodeHandle;
   using iterator = Iterator;
   using const_iterator = ConstIterator;
+  using node_type = NodeHandle;
 
 private:
 class Node
 {
     public:
     value_type node;
+    std::size_t hash_code; // full hash of the key, saves rehashing on lookups and comparisons
     Node *next;
     Node *prev;
 
-    Node(): next(nullptr), prev(nullptr) {}
-    Node(const KeyType key, mapped_type value): node (key,value), next(nullptr), prev(nullptr) {}
+    Node(): hash_code(0), next(nullptr), prev(nullptr) {}
+    Node(const KeyType key, mapped_type value): node (key,std::move(value)), hash_code(std::hash<KeyType>{}(node.first)), next(nullptr), prev(nullptr) {}
+    Node(const KeyType key, mapped_type value, std::size_t hash_code): node (key,std::move(value)), hash_code(hash_code), next(nullptr), prev(nullptr) {}
 };
 
+public:
+  // entries kept inside the map object before the first table is allocated. none by default,
+  // as every slot adds a node to the size of the map even while it is empty
+  static constexpr std::size_t inline_capacity = InlineCapacity;
+
+private:
 Node **table;
-int size;
-int bucket_count;
+size_type size;
+size_type bucket_count;
+// while the table grows the previous one is kept and emptied a few buckets per operation.
+// buckets of both tables share one index space: table first, then old_table
+Node **old_table;
+size_type old_bucket_count;
+size_type migrated; // old buckets below this one are already moved to table
+bool incremental_rehash;
+bool huge_pages; // tables and compaction blocks allocated from now on use huge pages
+size_type requested_buckets; // bucket count used once the map outgrows the inline storage
+Node *inline_bucket; // single chain serving as the table while the map is small
+detail::InlineSlots<Node, InlineCapacity> slots;
+detail::NodeArena<Node> arena; // nodes placed by compact()
+size_type compact_cursor; // next bucket compact() visits, compact_idle when no compaction is under way
+static constexpr size_type compact_idle = static_cast<size_type>(-1);
+
+bool is_small() const
+{
+    return table == &inline_bucket;
+}
 
-int hash(const key_type key) const
+bool is_inline(const Node *node) const
 {
-   return std::hash<key_type>{}(key) % bucket_count;
+    return slots.owns(node);
 }
 
+Node* make_node(const key_type& key, mapped_type value, std::size_t hash_code)
+{
+    void *memory = slots.allocate();
+    if (memory != nullptr) return new (memory) Node(key, std::move(value), hash_code);
+    return new Node(key, std::move(value), hash_code);
+}
 
-public:
+bool in_arena(const Node *node) const
+{
+    return !arena.empty() && arena.owns(node);
+}
+
+size_type heap_nodes() const
+{
+    return size - slots.count();
+}
+
+void free_node(Node *node)
+{
+    if (is_inline(node))
+    {
+        node->~Node();
+        slots.deallocate(node);
+    }
+    else if (in_arena(node))
+    {
+        node->~Node();
+        arena.deallocate(node);
+    }
+    else delete node;
+}
+
+// returns a heap node with the contents of node, which is freed if it lived in the inline storage or the arena
+Node* to_heap(Node *node)
+{
+    if (!is_inline(node) && !in_arena(node)) return node;
+    Node *moved = new Node(node->node.first, std::move(node->node.second), node->hash_code);
+    free_node(node);
+    return moved;
+}
+
+// makes node of other owned by this map, it is copied only if it lived in other's inline storage or arena
+Node* take(HashMap& other, Node *node)
+{
+    if (!other.is_inline(node) && !other.in_arena(node)) return node;
+    Node *moved = make_node(node->node.first, std::move(node->node.second), node->hash_code);
+    other.free_node(node);
+    return moved;
+}
+
+// moves a linked node to memory at target, keeping its position in the chain
+void relocate(Node *node, void *target)
+{
+    Node *moved = new (target) Node(node->node.first, std::move(node->node.second), node->hash_code);
+    moved->next = node->next;
+    moved->prev = node->prev;
+    if (moved->prev != nullptr) moved->prev->next = moved;
+    else bucket(bucket_of(moved->hash_code)) = moved;
+    if (moved->next != nullptr) moved->next->prev = moved;
+    node->~Node();
+}
 
+// moves a linked heap or arena node to the block compact() fills, returns where it is now
+Node* move_to_arena(Node *node)
+{
+    void *target = arena.allocate();
+    if (target == nullptr) return node;
+    bool from_arena = arena.owns(node);
+    relocate(node, target);
+    if (from_arena) arena.deallocate(node);
+    else ::operator delete(node);
+    return static_cast<Node*>(target);
+}
 
-  HashMap(int buckets_number = 10): size(0), bucket_count(buckets_number)
+// whether the heap nodes fill one arena block in bucket order, as a compaction leaves them
+// when nothing is written while it runs
+bool laid_out() const
+{
+    if (!arena.packed(heap_nodes())) return false;
+    std::size_t index = 0;
+    for (size_type bucket_id = 0; bucket_id < total_buckets(); bucket_id++)
+        for (Node *current = bucket(bucket_id); current != nullptr; current = current->next)
+            if (!is_inline(current) && !arena.at(current, index++)) return false;
+    return true;
+}
+
+Node** allocate_table(size_type count) const
+{
+    return detail::PageAllocator::allocate_array<Node*>(count, huge_pages);
+}
+
+static void free_table(Node **freed)
+{
+    detail::PageAllocator::deallocate(freed);
+}
+
+void init_small()
+{
+    inline_bucket = nullptr;
+    table = &inline_bucket;
+    bucket_count = 1;
+    old_table = nullptr;
+    old_bucket_count = 0;
+    migrated = 0;
+}
+
+// moves to a table of new_count buckets. old buckets are moved over by later insertions
+// unless incremental_rehash is off
+void start_resize(size_type new_count)
+{
+    if (old_table != nullptr) finish_resize();
+    old_table = table;
+    old_bucket_count = bucket_count;
+    migrated = 0;
+    if (compact_cursor != compact_idle) compact_cursor = 0; // bucket order changes, a running compaction starts over
+    table = allocate_table(new_count);
+    bucket_count = new_count;
+    if (!incremental_rehash) finish_resize();
+}
+
+// moves one old bucket to the new table, nodes keep their addresses
+void migrate_bucket()
+{
+    Node *current = old_table[migrated], *next, **head;
+    old_table[migrated] = nullptr;
+    migrated++;
+    for (; current != nullptr; current = next)
+    {
+        next = current->next;
+        head = &table[current->hash_code % bucket_count];
+        current->prev = nullptr;
+        current->next = *head;
+        if (*head != nullptr) (*head)->prev = current;
+        *head = current;
+    }
+    if (migrated == old_bucket_count)
+    {
+        free_table(old_table);
+        old_table = nullptr;
+        old_bucket_count = 0;
+        migrated = 0;
+    }
+}
+
+// bounded share of the resize work done by each insertion. lookups and removals leave both
+// tables alone, so they never change the order of an iteration under way
+void migrate_step()
+{
+    for (int step = 0; step < migration_step && old_table != nullptr; step++)
+        migrate_bucket();
+}
+
+void finish_resize()
+{
+    while (old_table != nullptr) migrate_bucket();
+}
+
+void grow_if_needed()
+{
+    if (!is_small() && old_table == nullptr && size > bucket_count * max_load_factor)
+        start_resize(bucket_count * 2);
+}
+
+// leaves the inline storage behind once it is full, nodes keep their addresses
+void spill()
+{
+    Node *current = inline_bucket, *next;
+    table = allocate_table(requested_buckets);
+    bucket_count = requested_buckets;
+    size = 0;
+    while (current != nullptr)
+    {
+        next = current->next;
+        current->next = current->prev = nullptr;
+        link(current);
+        current = next;
+    }
+}
+
+// takes all nodes of other, inline ones are moved to the inline storage here
+void steal(HashMap& other)
+{
+    requested_buckets = other.requested_buckets;
+    if (other.is_small()) init_small();
+    else
+    {
+        table = other.table;
+        bucket_count = other.bucket_count;
+        old_table = other.old_table;
+        old_bucket_count = other.old_bucket_count;
+        migrated = other.migrated;
+    }
+    incremental_rehash = other.incremental_rehash;
+    huge_pages = other.huge_pages;
+    inline_bucket = other.inline_bucket;
+    arena = std::move(other.arena);
+    compact_cursor = compact_idle;
+    other.compact_cursor = compact_idle;
+    size = other.size;
+    for (std::size_t slot = 0; slot < inline_capacity; slot++)
+        if (other.slots.occupied(slot)) relocate(other.slots.at(slot), slots.allocate());
+    other.slots.clear();
+    other.size = 0;
+    other.init_small();
+}
+
+// index of the bucket holding nodes with this hash, keys of old buckets not moved yet stay there
+size_type bucket_of(std::size_t hash_code) const
+{
+   if (old_table != nullptr)
+   {
+       size_type old_id = hash_code % old_bucket_count;
+       if (old_id >= migrated) return bucket_count + old_id;
+   }
+   return hash_code % bucket_count;
+}
+
+size_type total_buckets() const
+{
+    return bucket_count + old_bucket_count;
+}
+
+Node*& bucket(size_type bucket_id)
+{
+    return bucket_id < bucket_count ? table[bucket_id] : old_table[bucket_id - bucket_count];
+}
+
+Node* bucket(size_type bucket_id) const
+{
+    return bucket_id < bucket_count ? table[bucket_id] : old_table[bucket_id - bucket_count];
+}
+
+// number of bucket ranges a parallel scan is split into
+size_type partitions(unsigned threads) const
+{
+    size_type parts = static_cast<size_type>(detail::worker_count(threads)) * 8;
+    return parts < total_buckets() ? parts : total_buckets();
+}
+
+size_type part_begin(size_type part, size_type parts) const
+{
+    return total_buckets() / parts * part + total_buckets() % parts * part / parts;
+}
+
+Node* lookup(const key_type& key, std::size_t hash_code) const
+{
+    Node *current = bucket(bucket_of(hash_code));
+    while (current != nullptr && (current->hash_code != hash_code || current->node.first != key))
+        current = current->next;
+    return current;
+}
+
+// node of key, a new one with a default value when the key is missing
+Node* place(const key_type& key, bool& inserted)
+{
+    std::size_t hash_code = std::hash<key_type>{}(key);
+    size_type bucket_id = bucket_of(hash_code);
+    Node *current = bucket(bucket_id);
+    Node *prev = nullptr;
+    while (current != nullptr && (current->hash_code != hash_code || current->node.first != key))
+    {
+        prev = current;
+        current = current->next;
+    }
+    inserted = (current == nullptr);
+    if (current != nullptr) return current; //current->node.first == key
+
+    // link() moves old buckets on before inserting, which may take the chain found here away
+    if (old_table != nullptr || (is_small() && size == inline_capacity))
+        return link(make_node(key, mapped_type{}, hash_code));
+
+    size++;
+    Node *new_node = make_node(key, mapped_type{}, hash_code);
+    if (prev == nullptr) //bucket was empty
+    {
+        bucket(bucket_id) = new_node;
+    }
+    else
+    {
+        prev->next = new_node;
+        new_node->prev = prev;
+    }
+    grow_if_needed();
+    return new_node;
+}
+
+void unlink(Node *node)
+{
+    if (node->prev != nullptr) node->prev->next = node->next;
+    else bucket(bucket_of(node->hash_code)) = node->next;
+    if (node->next != nullptr) node->next->prev = node->prev;
+    node->next = nullptr;
+    node->prev = nullptr;
+    size--;
+}
+
+// appends node at the end of its bucket unless the key is already there,
+// returns the node holding the key
+Node* link(Node *node)
+{
+    migrate_step();
+    size_type bucket_id = bucket_of(node->hash_code);
+    Node *current = bucket(bucket_id);
+    Node *prev = nullptr;
+    while (current != nullptr && (current->hash_code != node->hash_code || current->node.first != node->node.first))
+    {
+        prev = current;
+        current = current->next;
+    }
+    if (current != nullptr) return current;
+    if (is_small() && size == inline_capacity)
+    {
+        spill();
+        return link(node);
+    }
+
+    size++;
+    if (prev == nullptr) bucket(bucket_id) = node;
+    else
+    {
+        prev->next = node;
+        node->prev = prev;
+    }
+    grow_if_needed();
+    return node;
+}
+
+
+public:
+  static constexpr int max_load_factor = 1; // entries per bucket that make the table grow
+  static constexpr int migration_step = 4; // old buckets moved by every insertion
+
+  HashMap(size_type buckets_number = 10): size(0), incremental_rehash(true), huge_pages(false), requested_buckets(buckets_number), compact_cursor(compact_idle)
   {
-    table = new Node* [buckets_number]();
+    init_small();
   }
 
   HashMap(std::initializer_list<value_type> list): HashMap()
@@ -61,37 +424,35 @@ public:
         (*this)[it->first] = it->second;
   }
 
-  HashMap(const HashMap& other): HashMap(other.bucket_count)
+  HashMap(const HashMap& other): HashMap(other.requested_buckets)
   {
     for (iterator it = other.begin(); it != other.end(); it++)
         (*this)[it->first] = it->second;
   }
 
-  HashMap(HashMap&& other): HashMap(other.bucket_count)
+  HashMap(HashMap&& other)
   {
-     for (iterator it = other.begin(); it != other.end(); it++)
-        (*this)[it->first] = it->second;
-
-    other.table = nullptr;
-    other.size = 0;
-    other.bucket_count = 0;
+    steal(other);
   }
 
    void delete_all()
    {
     Node *current, *next;
     size = 0;
-    for (int bucket_id = 0; bucket_id < bucket_count; bucket_id++)
+    for (size_type bucket_id = 0; bucket_id < total_buckets(); bucket_id++)
     {
-        current = table[bucket_id];
+        current = bucket(bucket_id);
         while (current != nullptr)
         {
             next = current->next;
-            delete current;
+            free_node(current);
             current = next;
         }
     }
-    delete[] table;
+    if (!is_small()) free_table(table);
+    free_table(old_table);
+    init_small();
+    compact_cursor = compact_idle;
    }
 
   ~HashMap()
@@ -99,11 +460,77 @@ public:
     delete_all();
   }
 
+  // moves the nodes into one contiguous block in bucket order, so lookups and scans touch
+  // neighbouring memory again, and shrinks a table left oversized by removals. memory of the
+  // old layout is returned as it empties. works for at most budget and returns true once the
+  // map is compact, a later call carries on from where this one stopped
+  bool compact(std::chrono::nanoseconds budget = std::chrono::nanoseconds::max())
+  {
+    using clock = std::chrono::steady_clock;
+    bool bounded = budget != std::chrono::nanoseconds::max();
+    clock::time_point deadline = bounded ? clock::now() + budget : clock::time_point::max();
+    if (compact_cursor == compact_idle)
+    {
+        if (is_small()) return true;
+        size_type wanted = size / max_load_factor + 1;
+        if (wanted < requested_buckets) wanted = requested_buckets;
+        bool oversized = bucket_count > 2 * wanted;
+        if (!oversized && old_table == nullptr && laid_out()) return true;
+        if (old_table == nullptr && oversized) start_resize(wanted);
+        arena.start_block(heap_nodes());
+        compact_cursor = 0;
+    }
+    size_type work = 0;
+    while (true)
+    {
+        while (old_table != nullptr)
+        {
+            migrate_bucket();
+            if (++work % 64 == 0 && bounded && clock::now() >= deadline) return false;
+        }
+        while (compact_cursor < total_buckets())
+        {
+            for (Node *current = bucket(compact_cursor); current != nullptr; current = current->next)
+                if (!is_inline(current) && !arena.in_current(current)) current = move_to_arena(current);
+            compact_cursor++;
+            if (++work % 64 == 0 && bounded && clock::now() >= deadline) return false;
+        }
+        // writes between the steps of a budgeted compaction may have left nodes behind, out
+        // of order or with gaps between them, then they are moved once more
+        if (laid_out()) break;
+        arena.start_block(heap_nodes());
+        compact_cursor = 0;
+    }
+    compact_cursor = compact_idle;
+    return true;
+  }
+
+  void shrink_to_fit()
+  {
+    compact();
+  }
+
+  // backs bucket tables allocated from now on, and the blocks compact() moves nodes into, with
+  // huge pages where the system offers them, which keeps the tlb from thrashing on very large
+  // maps. the table in use moves over on its next resize, nodes on the next compact()
+  void use_huge_pages(bool enabled)
+  {
+    huge_pages = enabled;
+    arena.use_huge_pages(enabled);
+  }
+
+  // with incremental rehash off a growing table is rehashed at once
+  void set_incremental_rehash(bool enabled)
+  {
+    incremental_rehash = enabled;
+    if (!enabled) finish_resize();
+  }
+
   HashMap& operator=(const HashMap& other)
   {
-    if (*this == other) return *this;
+    if (this == &other) return *this;
     delete_all();
-    table = new Node* [other.bucket_count]();
+    requested_buckets = other.requested_buckets;
     for (iterator it = other.begin(); it != other.end(); it++)
         (*this)[it->first] = it->second;
     return *this;
@@ -111,16 +538,9 @@ public:
 
   HashMap& operator=(HashMap&& other)
   {
-    if (*this != other)
-    {
-        delete_all();
-        table = new Node* [other.bucket_count]();
-        for (iterator it = other.begin(); it != other.end(); it++)
-            (*this)[it->first] = it->second;
-    }
-    other.table = nullptr;
-    other.size = 0;
-    other.bucket_count = 0;
+    if (this == &other) return *this;
+    delete_all();
+    steal(other);
     return *this;
   }
 
@@ -132,29 +552,16 @@ public:
 
   mapped_type& operator[](const key_type& key)
   {
-        int bucket_id = hash(key);
-        Node *current = table [bucket_id];
-        Node *prev = nullptr;
-        while (current != nullptr && current->node.first != key)
-        {
-            prev = current;
-            current = current->next;
-        }
-        if (current != nullptr) return current->node.second; //current->node.first == key
-
-        size++;
-        Node *new_node = new Node (key, mapped_type{});
-        if (prev == nullptr) //bucket was empty
-        {
-            table [bucket_id] = new_node;
-        }
-        else
-        {
-            prev->next = new_node;
-            new_node->prev = prev;
-        }
-        return new_node->node.second;
+    bool inserted;
+    return place(key, inserted)->node.second;
+  }
 
+  // the entry of key and whether it was just added with a default value, from a single lookup
+  std::pair<iterator, bool> try_emplace(const key_type& key)
+  {
+    bool inserted;
+    Node *node = place(key, inserted);
+    return std::make_pair(Iterator(ConstIterator(this, bucket_of(node->hash_code), node)), inserted);
   }
 
   const mapped_type& valueOf(const key_type& key) const
@@ -177,63 +584,77 @@ public:
 
   const_iterator find(const key_type& key) const
   {
-    int bucket_id = hash(key);
-    Node* current = table [bucket_id];
-    while (current != nullptr && current->node.first != key)
-        current = current->next;
-
-    return ConstIterator(this, bucket_id, current);
+    std::size_t hash_code = std::hash<key_type>{}(key);
+    Node* current = lookup(key, hash_code);
+    if (current == nullptr) return cend();
+    return ConstIterator(this, bucket_of(hash_code), current);
   }
 
   iterator find(const key_type& key)
   {
-    int bucket_id = hash(key);
-    Node* current = table [bucket_id];
-    while (current != nullptr && current->node.first != key)
-        current = current->next;
-
-    return Iterator(ConstIterator(this, bucket_id, current));
+    return Iterator(static_cast<const HashMap*>(this)->find(key));
   }
 
   void remove(const key_type& key)
   {
-    int bucket_id = hash(key);
-    Node *current = table[bucket_id];
-    while (current != nullptr && current->node.first != key)
-        current = current->next;
-
+    Node *current = lookup(key, std::hash<key_type>{}(key));
     if (current == nullptr) throw std::out_of_range("such key doesn't exist");
-    if(current->next == nullptr) /*deleting last element in bucket */
-    {
-        if (current->prev != nullptr) current->prev->next = nullptr; // there is still an element in bucket
-        else table[bucket_id] = nullptr; //now bucket is empty
-        delete current;
-    }
-    else  //removing from middle
-    {
-        current->prev-> next = current->next;
-        current->next->prev = current->prev;
-        delete current;
-    }
-    size--;
+    unlink(current);
+    free_node(current);
   }
 
   void remove(const const_iterator& it)
   {
     if (it == cend()) throw std::out_of_range("cannot erase end");
-    if(it.node->next == nullptr) /*deleting last element in bucket */
-    {
-        if (it.node->prev != nullptr) it.node->prev->next = nullptr; // there is still an element in bucket
-        else table[it.bucket_id] = nullptr; //now bucket is empty
-        delete it.node;
-    }
-    else  //removing from middle
+    unlink(it.node);
+    free_node(it.node);
+  }
+
+  node_type extract(const key_type& key)
+  {
+    Node *current = lookup(key, std::hash<key_type>{}(key));
+    if (current == nullptr) return node_type();
+    unlink(current);
+    return node_type(to_heap(current));
+  }
+
+  // entries kept in the inline storage are moved to a heap node
+  node_type extract(const const_iterator& it)
+  {
+    if (it == cend()) throw std::out_of_range("cannot extract end");
+    unlink(it.node);
+    return node_type(to_heap(it.node));
+  }
+
+  // on a key collision the handle keeps its node and the existing entry is returned
+  std::pair<iterator, bool> insert(node_type&& handle)
+  {
+    if (handle.empty()) return std::make_pair(end(), false);
+    Node *linked = link(handle.node);
+    bool inserted = (linked == handle.node);
+    if (inserted) handle.node = nullptr;
+    return std::make_pair(Iterator(ConstIterator(this, bucket_of(linked->hash_code), linked)), inserted);
+  }
+
+  // moves every node whose key is not present here, nodes are relinked, not copied
+  void merge(HashMap& other)
+  {
+    if (&other == this) return;
+    Node *current, *next;
+    for (size_type bucket_id = 0; bucket_id < other.total_buckets(); bucket_id++)
     {
-        it.node->prev-> next = it.node->next;
-        it.node->next->prev = it.node->prev;
-        delete it.node;
+        current = other.bucket(bucket_id);
+        while (current != nullptr)
+        {
+            next = current->next;
+            if (lookup(current->node.first, current->hash_code) == nullptr)
+            {
+                other.unlink(current);
+                link(take(other, current));
+            }
+            current = next;
+        }
     }
-    size--;
   }
 
   size_type getSize() const
@@ -241,19 +662,20 @@ public:
     return size;
   }
 
+  // keys of both maps are matched through the cached hashes, nothing is rehashed
   bool operator==(const HashMap& other) const
   {
+    if (this == &other) return true;
     if (size != other.size) return false;
-    Iterator search_key;
-    for (Iterator it = begin(); it != end();  it++)
-    {
-        search_key = other.find (it->first);
-        if (search_key == end() || search_key->second != it->second)
-            return false;
-    }
-
+    Node *current, *match;
+    for (size_type bucket_id = 0; bucket_id < total_buckets(); bucket_id++)
+        for (current = bucket(bucket_id); current != nullptr; current = current->next)
+        {
+            match = other.lookup(current->node.first, current->hash_code);
+            if (match == nullptr || match->node.second != current->node.second)
+                return false;
+        }
     return true;
-
   }
 
   bool operator!=(const HashMap& other) const
@@ -261,6 +683,166 @@ public:
     return !(*this == other);
   }
 
+  // adds entries of other whose keys are missing here, existing values are kept
+  void union_with(const HashMap& other)
+  {
+    if (this == &other) return;
+    Node *current;
+    for (size_type bucket_id = 0; bucket_id < other.total_buckets(); bucket_id++)
+        for (current = other.bucket(bucket_id); current != nullptr; current = current->next)
+            if (lookup(current->node.first, current->hash_code) == nullptr)
+                link(make_node(current->node.first, current->node.second, current->hash_code));
+  }
+
+  // removes entries whose keys are missing in other
+  void intersect_with(const HashMap& other)
+  {
+    Node *current, *next;
+    for (size_type bucket_id = 0; bucket_id < total_buckets(); bucket_id++)
+        for (current = bucket(bucket_id); current != nullptr; current = next)
+        {
+            next = current->next;
+            if (other.lookup(current->node.first, current->hash_code) == nullptr)
+            {
+                unlink(current);
+                free_node(current);
+            }
+        }
+  }
+
+  // entries of this map whose keys are missing in other
+  HashMap difference(const HashMap& other) const
+  {
+    HashMap result(requested_buckets);
+    Node *current;
+    for (size_type bucket_id = 0; bucket_id < total_buckets(); bucket_id++)
+        for (current = bucket(bucket_id); current != nullptr; current = current->next)
+            if (other.lookup(current->node.first, current->hash_code) == nullptr)
+                result.link(result.make_node(current->node.first, current->node.second, current->hash_code));
+    return result;
+  }
+
+  struct Diff
+  {
+    std::vector<key_type> added; // present only in the other map
+    std::vector<key_type> removed; // present only in this map
+    std::vector<key_type> changed; // present in both with different values
+  };
+
+  // describes how to get from this map to other
+  Diff diff(const HashMap& other) const
+  {
+    Diff result;
+    Node *current, *match;
+    for (size_type bucket_id = 0; bucket_id < total_buckets(); bucket_id++)
+        for (current = bucket(bucket_id); current != nullptr; current = current->next)
+        {
+            match = other.lookup(current->node.first, current->hash_code);
+            if (match == nullptr) result.removed.push_back(current->node.first);
+            else if (match->node.second != current->node.second) result.changed.push_back(current->node.first);
+        }
+    for (size_type bucket_id = 0; bucket_id < other.total_buckets(); bucket_id++)
+        for (current = other.bucket(bucket_id); current != nullptr; current = current->next)
+            if (lookup(current->node.first, current->hash_code) == nullptr)
+                result.added.push_back(current->node.first);
+    return result;
+  }
+
+  // calls f on every entry, bucket ranges are spread over threads (0 means all cores).
+  // f runs concurrently and the entries come in no particular order
+  template <typename Function>
+  void parallel_for_each(Function f, unsigned threads = 0) const
+  {
+    size_type parts = partitions(threads);
+    detail::parallel_run(parts, threads, [&](std::size_t part)
+    {
+        for (size_type bucket_id = part_begin(part, parts); bucket_id < part_begin(part + 1, parts); bucket_id++)
+            for (Node *current = bucket(bucket_id); current != nullptr; current = current->next)
+                f(static_cast<const_reference>(current->node));
+    });
+  }
+
+  template <typename Function>
+  void parallel_for_each(Function f, unsigned threads = 0)
+  {
+    size_type parts = partitions(threads);
+    detail::parallel_run(parts, threads, [&](std::size_t part)
+    {
+        for (size_type bucket_id = part_begin(part, parts); bucket_id < part_begin(part + 1, parts); bucket_id++)
+            for (Node *current = bucket(bucket_id); current != nullptr; current = current->next)
+                f(current->node);
+    });
+  }
+
+  // folds every bucket range with op(accumulated, entry) starting from identity,
+  // then folds the partial results with combine in bucket order
+  template <typename T, typename Operation, typename Combine>
+  T parallel_reduce(T identity, Operation op, Combine combine, unsigned threads = 0) const
+  {
+    size_type parts = partitions(threads);
+    std::vector<T> partial(parts, identity);
+    detail::parallel_run(parts, threads, [&](std::size_t part)
+    {
+        T accumulated = identity;
+        for (size_type bucket_id = part_begin(part, parts); bucket_id < part_begin(part + 1, parts); bucket_id++)
+            for (Node *current = bucket(bucket_id); current != nullptr; current = current->next)
+                accumulated = op(std::move(accumulated), static_cast<const_reference>(current->node));
+        partial[part] = std::move(accumulated);
+    });
+    T result = identity;
+    for (auto& value : partial) result = combine(std::move(result), std::move(value));
+    return result;
+  }
+
+  // removes entries matching pred, buckets are unlinked in parallel, returns how many were removed.
+  // unlinked nodes are freed and counted only once every worker is done, so if pred throws the
+  // entries matched until then are removed and the exception is passed on
+  template <typename Predicate>
+  size_type parallel_erase_if(Predicate pred, unsigned threads = 0)
+  {
+    size_type parts = partitions(threads);
+    std::vector<Node*> removed(parts, nullptr); // per part list chained through next
+    auto reclaim = [&]()
+    {
+        size_type count = 0;
+        Node *current, *next;
+        for (Node *list : removed)
+            for (current = list; current != nullptr; current = next)
+            {
+                next = current->next;
+                free_node(current);
+                count++;
+            }
+        size -= count;
+        return count;
+    };
+    try
+    {
+      detail::parallel_run(parts, threads, [&](std::size_t part)
+      {
+          Node *current, *next;
+          for (size_type bucket_id = part_begin(part, parts); bucket_id < part_begin(part + 1, parts); bucket_id++)
+              for (current = bucket(bucket_id); current != nullptr; current = next)
+              {
+                  next = current->next;
+                  if (!pred(static_cast<const_reference>(current->node))) continue;
+                  if (current->prev != nullptr) current->prev->next = next;
+                  else bucket(bucket_id) = next;
+                  if (next != nullptr) next->prev = current->prev;
+                  current->prev = nullptr;
+                  current->next = removed[part];
+                  removed[part] = current;
+              }
+      });
+    }
+    catch (...)
+    {
+      reclaim();
+      throw;
+    }
+    return reclaim();
+  }
+
   iterator begin()
   {
     return iterator(cbegin());
@@ -274,14 +856,14 @@ public:
   const_iterator cbegin() const
   {
     if (size == 0) return cend();
-    int bucket_id = 0;
-    while (table[bucket_id] == nullptr) bucket_id++;
-    return ConstIterator(this, bucket_id,table[bucket_id] );
+    size_type bucket_id = 0;
+    while (bucket(bucket_id) == nullptr) bucket_id++;
+    return ConstIterator(this, bucket_id, bucket(bucket_id));
   }
 
   const_iterator cend() const
   {
-      return const_iterator(this, bucket_count, nullptr);
+      return const_iterator(this, total_buckets(), nullptr);
   }
 
   const_iterator begin() const
@@ -295,8 +877,65 @@ public:
   }
 };
 
-template <typename KeyType, typename ValueType>
-class HashMap<KeyType, ValueType>::ConstIterator
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class HashMap<KeyType, ValueType, InlineCapacity>::NodeHandle
+{
+friend class HashMap;
+private:
+  Node *node;
+
+  explicit NodeHandle(Node *node): node(node) {}
+public:
+  NodeHandle(): node(nullptr) {}
+  NodeHandle(const NodeHandle&) = delete;
+  NodeHandle& operator=(const NodeHandle&) = delete;
+
+  NodeHandle(NodeHandle&& other): node(other.node)
+  {
+    other.node = nullptr;
+  }
+
+  NodeHandle& operator=(NodeHandle&& other)
+  {
+    if (this != &other)
+    {
+        delete node;
+        node = other.node;
+        other.node = nullptr;
+    }
+    return *this;
+  }
+
+  ~NodeHandle()
+  {
+    delete node;
+  }
+
+  bool empty() const
+  {
+    return node == nullptr;
+  }
+
+  explicit operator bool() const
+  {
+    return node != nullptr;
+  }
+
+  const key_type& key() const
+  {
+    if (node == nullptr) throw std::out_of_range("empty node handle");
+    return node->node.first;
+  }
+
+  mapped_type& mapped() const
+  {
+    if (node == nullptr) throw std::out_of_range("empty node handle");
+    return node->node.second;
+  }
+};
+
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class HashMap<KeyType, ValueType, InlineCapacity>::ConstIterator
 {
 friend class HashMap;
 public:
@@ -307,12 +946,12 @@ public:
 
 private:
    const HashMap *hashmap;
-   int bucket_id;
+   size_type bucket_id;
    Node *node;
 public:
 
   explicit ConstIterator() : hashmap (nullptr), bucket_id(0), node (nullptr)   {}
-  ConstIterator(const HashMap *hashmap, int bucket_id, Node *node) : hashmap (hashmap), bucket_id(bucket_id), node (node) {}
+  ConstIterator(const HashMap *hashmap, size_type bucket_id, Node *node) : hashmap (hashmap), bucket_id(bucket_id), node (node) {}
   ConstIterator(const ConstIterator& other)
   {
      hashmap = other.hashmap;
@@ -326,11 +965,11 @@ public:
    if (node->next != nullptr) node = node->next;
    else
    {
-        bucket_id++;
-        while (bucket_id < hashmap->bucket_count && hashmap->table[bucket_id] == nullptr)
+        bucket_id = hashmap->bucket_of(node->hash_code) + 1; // the node may have moved since
+        while (bucket_id < hashmap->total_buckets() && hashmap->bucket(bucket_id) == nullptr)
            bucket_id++;
-        if (bucket_id == hashmap->bucket_count) node = nullptr;
-        else node = hashmap->table [bucket_id];
+        if (bucket_id == hashmap->total_buckets()) node = nullptr;
+        else node = hashmap->bucket(bucket_id);
 
    }
    return *this;
@@ -347,7 +986,7 @@ public:
   {
     if (node == nullptr) //end
     {
-        bucket_id = hashmap->bucket_count -1;
+        bucket_id = hashmap->total_buckets();
     }
     else if (node->prev != nullptr)
     {
@@ -356,14 +995,16 @@ public:
     }
     else
     {
-        bucket_id -- ;
+        bucket_id = hashmap->bucket_of(node->hash_code);
         node =  nullptr;
     }
 
-    while (bucket_id != -1 && hashmap->table[bucket_id] == nullptr)
+    // bucket_id is one past the bucket to look at next
+    while (bucket_id != 0 && hashmap->bucket(bucket_id - 1) == nullptr)
            bucket_id--;
-    if (bucket_id == -1) throw std::out_of_range("cannot decrement begin iterator");
-    node = hashmap->table [bucket_id];
+    if (bucket_id == 0) throw std::out_of_range("cannot decrement begin iterator");
+    bucket_id--;
+    node = hashmap->bucket(bucket_id);
     while (node->next != nullptr) node = node->next;
      return *this;
   }
@@ -398,8 +1039,8 @@ public:
   }
 };
 
-template <typename KeyType, typename ValueType>
-class HashMap<KeyType, ValueType>::Iterator : public HashMap<KeyType, ValueType>::ConstIterator
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class HashMap<KeyType, ValueType, InlineCapacity>::Iterator : public HashMap<KeyType, ValueType, InlineCapacity>::ConstIterator
 {
 public:
   using reference = typename HashMap::reference;
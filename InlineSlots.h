@@ -0,0 +1,123 @@
+#ifndef AISDI_MAPS_INLINESLOTS_H
+#define AISDI_MAPS_INLINESLOTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace aisdi
+{
+namespace detail
+{
+
+// room for the first few nodes of a map inside the map object, a bit per slot tells which
+// are taken. the slots are raw memory, the map constructs and destroys the nodes in them
+template <typename Node, std::size_t Capacity>
+class InlineSlots
+{
+  static_assert(Capacity <= 32, "taken slots are tracked in a 32 bit mask");
+
+  using Slot = typename std::aligned_storage<sizeof(Node), alignof(Node)>::type;
+
+  Slot slots[Capacity];
+  std::uint32_t used;
+
+public:
+  InlineSlots(): used(0) {}
+
+  InlineSlots(const InlineSlots&) = delete;
+  InlineSlots& operator=(const InlineSlots&) = delete;
+
+  bool owns(const Node *node) const
+  {
+    const Slot *slot = reinterpret_cast<const Slot*>(node);
+    return slot >= slots && slot < slots + Capacity;
+  }
+
+  bool occupied(std::size_t slot) const
+  {
+    return (used & (std::uint32_t(1) << slot)) != 0;
+  }
+
+  // number of slots taken
+  std::size_t count() const
+  {
+    std::size_t counted = 0;
+    for (std::uint32_t bits = used; bits != 0; bits &= bits - 1) counted++;
+    return counted;
+  }
+
+  Node* at(std::size_t slot)
+  {
+    return reinterpret_cast<Node*>(&slots[slot]);
+  }
+
+  // memory for one node, nullptr when every slot is taken
+  void* allocate()
+  {
+    for (std::size_t slot = 0; slot < Capacity; slot++)
+      if (!occupied(slot))
+      {
+        used |= std::uint32_t(1) << slot;
+        return &slots[slot];
+      }
+    return nullptr;
+  }
+
+  // gives back the slot of a destroyed node
+  void deallocate(const Node *node)
+  {
+    used &= ~(std::uint32_t(1) << (reinterpret_cast<const Slot*>(node) - slots));
+  }
+
+  // forgets every slot, their nodes must already be destroyed or moved out
+  void clear()
+  {
+    used = 0;
+  }
+};
+
+// no inline storage at all, the member takes no more than an empty object
+template <typename Node>
+class InlineSlots<Node, 0>
+{
+public:
+  InlineSlots() {}
+
+  InlineSlots(const InlineSlots&) = delete;
+  InlineSlots& operator=(const InlineSlots&) = delete;
+
+  bool owns(const Node*) const
+  {
+    return false;
+  }
+
+  bool occupied(std::size_t) const
+  {
+    return false;
+  }
+
+  std::size_t count() const
+  {
+    return 0;
+  }
+
+  Node* at(std::size_t)
+  {
+    return nullptr;
+  }
+
+  void* allocate()
+  {
+    return nullptr;
+  }
+
+  void deallocate(const Node*) {}
+
+  void clear() {}
+};
+
+}
+}
+
+#endif /* AISDI_MAPS_INLINESLOTS_H */
@@ -0,0 +1,154 @@
+#ifndef AISDI_MAPS_NODEARENA_H
+#define AISDI_MAPS_NODEARENA_H
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "PageAllocator.h"
+
+namespace aisdi
+{
+namespace detail
+{
+
+// contiguous blocks of node slots filled by compaction. slots are handed out in order from
+// the last block and never reused, a block is returned to the system once all its nodes
+// are gone. the arena does not construct or destroy nodes, the map does
+template <typename Node>
+class NodeArena
+{
+  using Slot = typename std::aligned_storage<sizeof(Node), alignof(Node)>::type;
+
+  struct Block
+  {
+    Slot *memory;
+    std::size_t capacity;
+    std::size_t used; // slots handed out
+    std::size_t live; // slots handed out and not given back
+  };
+
+  std::vector<Block> blocks; // the last block is being filled
+  bool huge_pages; // blocks started from now on are backed by huge pages
+
+  static bool contains(const Block& block, const Node *node)
+  {
+    const Slot *slot = reinterpret_cast<const Slot*>(node);
+    return slot >= block.memory && slot < block.memory + block.capacity;
+  }
+
+public:
+  NodeArena(): huge_pages(false) {}
+
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  NodeArena(NodeArena&& other): blocks(std::move(other.blocks)), huge_pages(other.huge_pages)
+  {
+    other.blocks.clear();
+  }
+
+  NodeArena& operator=(NodeArena&& other)
+  {
+    if (this == &other) return *this;
+    release_all();
+    blocks = std::move(other.blocks);
+    huge_pages = other.huge_pages;
+    other.blocks.clear();
+    return *this;
+  }
+
+  // nodes must already be destroyed
+  ~NodeArena()
+  {
+    release_all();
+  }
+
+  void release_all()
+  {
+    for (Block& block : blocks) PageAllocator::deallocate(block.memory);
+    blocks.clear();
+  }
+
+  void use_huge_pages(bool enabled)
+  {
+    huge_pages = enabled;
+  }
+
+  bool empty() const
+  {
+    return blocks.empty();
+  }
+
+  // whether exactly nodes nodes fill the arena, in one block and without gaps
+  bool packed(std::size_t nodes) const
+  {
+    if (blocks.empty()) return nodes == 0;
+    return blocks.size() == 1 && blocks[0].used == nodes && blocks[0].live == nodes;
+  }
+
+  // starts a block for capacity nodes, later allocations come from it. the block filled so
+  // far is returned if none of its nodes are left
+  void start_block(std::size_t capacity)
+  {
+    if (!blocks.empty() && blocks.back().live == 0)
+    {
+      PageAllocator::deallocate(blocks.back().memory);
+      blocks.pop_back();
+    }
+    if (capacity == 0) return;
+    blocks.push_back(Block{PageAllocator::allocate_array<Slot>(capacity, huge_pages), capacity, 0, 0});
+  }
+
+  // memory for one node from the block being filled, nullptr when it is full
+  void* allocate()
+  {
+    if (blocks.empty()) return nullptr;
+    Block& block = blocks.back();
+    if (block.used == block.capacity) return nullptr;
+    block.live++;
+    return &block.memory[block.used++];
+  }
+
+  bool owns(const Node *node) const
+  {
+    for (const Block& block : blocks)
+      if (contains(block, node)) return true;
+    return false;
+  }
+
+  // whether node sits in the block being filled
+  bool in_current(const Node *node) const
+  {
+    return !blocks.empty() && contains(blocks.back(), node);
+  }
+
+  // whether node sits in slot index of the block being filled
+  bool at(const Node *node, std::size_t index) const
+  {
+    return !blocks.empty() && index < blocks.back().used && reinterpret_cast<const Slot*>(node) == blocks.back().memory + index;
+  }
+
+  // gives back the memory of a destroyed node, whole blocks are freed when they empty
+  void deallocate(Node *node)
+  {
+    for (std::size_t i = 0; i < blocks.size(); i++)
+      if (contains(blocks[i], node))
+      {
+        Block& block = blocks[i];
+        block.live--;
+        bool filling = (i + 1 == blocks.size() && block.used < block.capacity);
+        if (block.live == 0 && !filling)
+        {
+          PageAllocator::deallocate(block.memory);
+          blocks.erase(blocks.begin() + i);
+        }
+        return;
+      }
+  }
+};
+
+}
+}
+
+#endif /* AISDI_MAPS_NODEARENA_H */
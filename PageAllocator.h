@@ -0,0 +1,119 @@
+#ifndef AISDI_MAPS_PAGEALLOCATOR_H
+#define AISDI_MAPS_PAGEALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace aisdi
+{
+namespace detail
+{
+
+// zeroed memory for bucket tables and node blocks. with huge pages requested, blocks of at least
+// one huge page are mapped on explicit huge pages (MAP_HUGETLB) if the system has some reserved,
+// otherwise on ordinary pages marked for transparent huge pages, and if mapping fails at all they
+// come from calloc. blocks start on a cache line. a header in front of every block records where
+// it came from, so deallocate releases any of them
+class PageAllocator
+{
+  static constexpr std::size_t huge_page = std::size_t(2) << 20;
+  static constexpr std::size_t header_size = 64; // a cache line, the block starts at the next one
+
+  enum class Source
+  {
+    heap,
+    mapped
+  };
+
+  struct Header
+  {
+    void *base; // what was mapped or allocated
+    std::size_t mapped_bytes;
+    Source source;
+  };
+
+  // writes the header at memory, which must be cache line aligned, and returns the block after it
+  static void* finish(void *memory, void *base, std::size_t mapped_bytes, Source source)
+  {
+    Header *header = static_cast<Header*>(memory);
+    header->base = base;
+    header->mapped_bytes = mapped_bytes;
+    header->source = source;
+    return static_cast<char*>(memory) + header_size;
+  }
+
+#if defined(__linux__)
+  static void* map(std::size_t bytes, bool explicit_pages)
+  {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_HUGETLB)
+    if (explicit_pages) flags |= MAP_HUGETLB;
+#else
+    if (explicit_pages) return nullptr;
+#endif
+    void *memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return memory == MAP_FAILED ? nullptr : memory;
+  }
+#endif
+
+public:
+  static void* allocate(std::size_t bytes, bool huge_pages)
+  {
+    if (bytes > static_cast<std::size_t>(-1) - huge_page) throw std::bad_alloc();
+#if defined(__linux__)
+    if (huge_pages && bytes + header_size >= huge_page)
+    {
+      std::size_t mapped_bytes = (bytes + header_size + huge_page - 1) / huge_page * huge_page;
+      void *memory = map(mapped_bytes, true);
+      if (memory == nullptr)
+      {
+        memory = map(mapped_bytes, false);
+#if defined(MADV_HUGEPAGE)
+        if (memory != nullptr) madvise(memory, mapped_bytes, MADV_HUGEPAGE);
+#endif
+      }
+      if (memory != nullptr) return finish(memory, memory, mapped_bytes, Source::mapped);
+    }
+#else
+    (void)huge_pages;
+#endif
+    // large zeroed blocks come straight from fresh pages, so this costs no upfront memset.
+    // calloc only promises fundamental alignment, a spare cache line leaves room to align the header
+    void *memory = std::calloc(1, bytes + 2 * header_size);
+    if (memory == nullptr) throw std::bad_alloc();
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(memory) + header_size - 1) & ~std::uintptr_t(header_size - 1);
+    return finish(reinterpret_cast<void*>(aligned), memory, 0, Source::heap);
+  }
+
+  template <typename T>
+  static T* allocate_array(std::size_t count, bool huge_pages)
+  {
+    if (count > static_cast<std::size_t>(-1) / sizeof(T)) throw std::bad_alloc();
+    return static_cast<T*>(allocate(count * sizeof(T), huge_pages));
+  }
+
+  static void deallocate(void *block)
+  {
+    if (block == nullptr) return;
+    Header *header = reinterpret_cast<Header*>(static_cast<char*>(block) - header_size);
+#if defined(__linux__)
+    if (header->source == Source::mapped)
+    {
+      munmap(header->base, header->mapped_bytes);
+      return;
+    }
+#endif
+    std::free(header->base);
+  }
+};
+
+}
+}
+
+#endif /* AISDI_MAPS_PAGEALLOCATOR_H */
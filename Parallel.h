@@ -0,0 +1,114 @@
+#ifndef AISDI_MAPS_PARALLEL_H
+#define AISDI_MAPS_PARALLEL_H
+
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aisdi
+{
+namespace detail
+{
+
+inline unsigned worker_count(unsigned requested)
+{
+  if (requested != 0) return requested;
+  unsigned available = std::thread::hardware_concurrency();
+  return available != 0 ? available : 1;
+}
+
+// range of task indices owned by one worker. the owner takes tasks from the front,
+// idle workers steal the back half
+class TaskRange
+{
+public:
+  std::mutex lock;
+  std::size_t first;
+  std::size_t last;
+
+  TaskRange(): first(0), last(0) {}
+
+  bool pop(std::size_t& task)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (first == last) return false;
+    task = first++;
+    return true;
+  }
+
+  bool steal_half(std::size_t& stolen_first, std::size_t& stolen_last)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (first == last) return false;
+    std::size_t middle = first + (last - first) / 2;
+    stolen_first = middle;
+    stolen_last = last;
+    last = middle;
+    return true;
+  }
+};
+
+// calls task(i) for every i in [0, tasks) on up to threads threads (0 means all cores),
+// the calling thread works too. the first exception thrown by a task is rethrown
+template <typename Task>
+void parallel_run(std::size_t tasks, unsigned threads, Task task)
+{
+  if (tasks == 0) return;
+  std::size_t workers = worker_count(threads);
+  if (workers > tasks) workers = tasks;
+  if (workers == 1)
+  {
+    for (std::size_t i = 0; i < tasks; i++) task(i);
+    return;
+  }
+
+  std::vector<TaskRange> ranges(workers);
+  for (std::size_t worker = 0; worker < workers; worker++)
+  {
+    ranges[worker].first = tasks * worker / workers;
+    ranges[worker].last = tasks * (worker + 1) / workers;
+  }
+  std::exception_ptr failure;
+  std::mutex failure_lock;
+
+  auto work = [&](std::size_t worker)
+  {
+    std::size_t current, stolen_first, stolen_last;
+    while (true)
+    {
+      while (ranges[worker].pop(current))
+      {
+        try
+        {
+          task(current);
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> guard(failure_lock);
+          if (!failure) failure = std::current_exception();
+        }
+      }
+      bool stole = false;
+      for (std::size_t offset = 1; offset < workers && !stole; offset++)
+        stole = ranges[(worker + offset) % workers].steal_half(stolen_first, stolen_last);
+      if (!stole) return;
+      std::lock_guard<std::mutex> guard(ranges[worker].lock);
+      ranges[worker].first = stolen_first;
+      ranges[worker].last = stolen_last;
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (std::size_t worker = 1; worker < workers; worker++)
+    pool.emplace_back(work, worker);
+  work(0);
+  for (auto& thread : pool) thread.join();
+  if (failure) std::rethrow_exception(failure);
+}
+
+}
+}
+
+#endif /* AISDI_MAPS_PARALLEL_H */
@@ -0,0 +1,1033 @@
+#ifndef AISDI_MAPS_RADIXTREEMAP_H
+#define AISDI_MAPS_RADIXTREEMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace aisdi
+{
+
+// ordered map for integral keys kept in an adaptive radix tree (ART). a key is split into bytes,
+// most significant first (with the sign bit flipped, so byte order is key order), and every inner
+// node branches on one byte. inner nodes grow and shrink between 4, 16, 48 and 256 children,
+// chains of single children are compressed into a prefix stored in the node below, and a key
+// that is alone in its subtree is kept in a leaf as high up as possible. leaves are linked in
+// key order, which gives O(1) iteration steps and cheap range scans
+template <typename KeyType, typename ValueType>
+class RadixTreeMap
+{
+  static_assert(std::is_integral<KeyType>::value && !std::is_same<KeyType, bool>::value,
+                "RadixTreeMap needs an integral key type");
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using value_type = std::pair<const key_type, mapped_type>;
+  using size_type = std::size_t;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+
+  class ConstIterator;
+  class Iterator;
+  using iterator = Iterator;
+  using const_iterator = ConstIterator;
+
+  static constexpr int key_bytes = sizeof(KeyType);
+
+private:
+  enum NodeType : std::uint8_t { leaf_node, node4, node16, node48, node256 };
+
+  // all a leaf shares with the other nodes is the type, so the entry packs right behind it
+  struct Node
+  {
+    NodeType type;
+
+    explicit Node(NodeType type): type(type) {}
+  };
+
+  // header of the nodes that branch
+  struct Inner : Node
+  {
+    std::uint8_t prefix_length; // bytes below the parent that all keys of this node share
+    std::uint16_t count; // children
+    std::uint8_t prefix[8];
+
+    explicit Inner(NodeType type): Node(type), prefix_length(0), count(0), prefix() {}
+  };
+
+  // node with up to Capacity children, keys sorted
+  template <int Capacity, NodeType Type>
+  struct SmallNode : Inner
+  {
+    std::uint8_t keys[Capacity];
+    Node *children[Capacity];
+
+    SmallNode(): Inner(Type), keys(), children() {}
+  };
+
+  using Node4 = SmallNode<4, node4>;
+  using Node16 = SmallNode<16, node16>;
+
+  struct Node48 : Inner
+  {
+    std::uint8_t index[256]; // position in children plus one, 0 for no child
+    Node *children[48];
+
+    Node48(): Inner(node48), index(), children() {}
+  };
+
+  struct Node256 : Inner
+  {
+    Node *children[256];
+
+    Node256(): Inner(node256), children() {}
+  };
+
+  // the order preserving image of the key is not kept, to_bits() rebuilds it with one xor
+  struct Leaf : Node
+  {
+    value_type entry;
+    Leaf *prev, *next;
+
+    Leaf(const key_type& key, mapped_type value): Node(leaf_node), entry(key, std::move(value)), prev(nullptr), next(nullptr) {}
+
+    std::uint64_t bits() const
+    {
+      return to_bits(entry.first);
+    }
+  };
+
+  Node *root;
+  Leaf *head; // smallest key
+  Leaf *tail; // largest key
+  size_type size;
+
+  static std::uint64_t to_bits(const key_type& key)
+  {
+    using Unsigned = typename std::make_unsigned<key_type>::type;
+    std::uint64_t bits = static_cast<Unsigned>(key);
+    if (std::is_signed<key_type>::value) bits ^= std::uint64_t(1) << (8 * key_bytes - 1);
+    return bits;
+  }
+
+  static std::uint8_t byte_at(std::uint64_t bits, int depth)
+  {
+    return static_cast<std::uint8_t>(bits >> (8 * (key_bytes - 1 - depth)));
+  }
+
+  static int lowest_bit(unsigned bits)
+  {
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#else
+    int bit = 0;
+    while ((bits & 1) == 0)
+    {
+      bits >>= 1;
+      bit++;
+    }
+    return bit;
+#endif
+  }
+
+  static bool is_leaf(const Node *node)
+  {
+    return node->type == leaf_node;
+  }
+
+  static Inner* inner(Node *node)
+  {
+    return static_cast<Inner*>(node);
+  }
+
+  static const Inner* inner(const Node *node)
+  {
+    return static_cast<const Inner*>(node);
+  }
+
+  // position of byte in a small node, -1 if it is not there
+  template <int Capacity, NodeType Type>
+  static int position_of(const SmallNode<Capacity, Type> *node, std::uint8_t byte)
+  {
+    for (int i = 0; i < node->count; i++)
+      if (node->keys[i] == byte) return i;
+    return -1;
+  }
+
+  // position of the first key greater than byte in a small node, count if there is none
+  template <int Capacity, NodeType Type>
+  static int position_after(const SmallNode<Capacity, Type> *node, std::uint8_t byte)
+  {
+    int i = 0;
+    while (i < node->count && node->keys[i] <= byte) i++;
+    return i;
+  }
+
+#if defined(__SSE2__)
+  // a Node16 compares all its keys at once
+  static int position_of(const Node16 *node, std::uint8_t byte)
+  {
+    __m128i keys = _mm_loadu_si128(reinterpret_cast<const __m128i*>(node->keys));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(keys, _mm_set1_epi8(static_cast<char>(byte))));
+    mask &= (1u << node->count) - 1;
+    return mask != 0 ? lowest_bit(mask) : -1;
+  }
+
+  static int position_after(const Node16 *node, std::uint8_t byte)
+  {
+    // sse2 only compares signed bytes, flipping the top bit keeps the unsigned order
+    __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+    __m128i keys = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(node->keys)), bias);
+    unsigned mask = _mm_movemask_epi8(_mm_cmpgt_epi8(keys, _mm_set1_epi8(static_cast<char>(byte ^ 0x80))));
+    mask &= (1u << node->count) - 1;
+    return mask != 0 ? lowest_bit(mask) : node->count;
+  }
+#endif
+
+  static Node** find_child(Node *node, std::uint8_t byte)
+  {
+    switch (node->type)
+    {
+    case node4:
+    {
+      Node4 *small = static_cast<Node4*>(node);
+      int position = position_of(small, byte);
+      return position >= 0 ? &small->children[position] : nullptr;
+    }
+    case node16:
+    {
+      Node16 *small = static_cast<Node16*>(node);
+      int position = position_of(small, byte);
+      return position >= 0 ? &small->children[position] : nullptr;
+    }
+    case node48:
+    {
+      Node48 *wide = static_cast<Node48*>(node);
+      return wide->index[byte] != 0 ? &wide->children[wide->index[byte] - 1] : nullptr;
+    }
+    case node256:
+    {
+      Node256 *full = static_cast<Node256*>(node);
+      return full->children[byte] != nullptr ? &full->children[byte] : nullptr;
+    }
+    default:
+      return nullptr;
+    }
+  }
+
+  // child with the smallest byte greater than byte (-1 gives the first child)
+  static Node* child_after(const Node *node, int byte)
+  {
+    switch (node->type)
+    {
+    case node4:
+    {
+      const Node4 *small = static_cast<const Node4*>(node);
+      int position = byte < 0 ? 0 : position_after(small, static_cast<std::uint8_t>(byte));
+      return position < small->count ? small->children[position] : nullptr;
+    }
+    case node16:
+    {
+      const Node16 *small = static_cast<const Node16*>(node);
+      int position = byte < 0 ? 0 : position_after(small, static_cast<std::uint8_t>(byte));
+      return position < small->count ? small->children[position] : nullptr;
+    }
+    case node48:
+    {
+      const Node48 *wide = static_cast<const Node48*>(node);
+      for (int next = byte + 1; next < 256; next++)
+        if (wide->index[next] != 0) return wide->children[wide->index[next] - 1];
+      return nullptr;
+    }
+    case node256:
+    {
+      const Node256 *full = static_cast<const Node256*>(node);
+      for (int next = byte + 1; next < 256; next++)
+        if (full->children[next] != nullptr) return full->children[next];
+      return nullptr;
+    }
+    default:
+      return nullptr;
+    }
+  }
+
+  static Node* last_child(const Node *node)
+  {
+    switch (node->type)
+    {
+    case node4:
+      return static_cast<const Node4*>(node)->children[inner(node)->count - 1];
+    case node16:
+      return static_cast<const Node16*>(node)->children[inner(node)->count - 1];
+    case node48:
+    {
+      const Node48 *wide = static_cast<const Node48*>(node);
+      for (int byte = 255; byte >= 0; byte--)
+        if (wide->index[byte] != 0) return wide->children[wide->index[byte] - 1];
+      return nullptr;
+    }
+    case node256:
+    {
+      const Node256 *full = static_cast<const Node256*>(node);
+      for (int byte = 255; byte >= 0; byte--)
+        if (full->children[byte] != nullptr) return full->children[byte];
+      return nullptr;
+    }
+    default:
+      return nullptr;
+    }
+  }
+
+  static Leaf* min_leaf(const Node *node)
+  {
+    while (!is_leaf(node)) node = child_after(node, -1);
+    return const_cast<Leaf*>(static_cast<const Leaf*>(node));
+  }
+
+  static Leaf* max_leaf(const Node *node)
+  {
+    while (!is_leaf(node)) node = last_child(node);
+    return const_cast<Leaf*>(static_cast<const Leaf*>(node));
+  }
+
+  static void copy_header(const Inner *from, Inner *to)
+  {
+    to->prefix_length = from->prefix_length;
+    to->count = from->count;
+    std::memcpy(to->prefix, from->prefix, sizeof(to->prefix));
+  }
+
+  template <int Capacity, NodeType Type>
+  static void insert_sorted(SmallNode<Capacity, Type> *node, std::uint8_t byte, Node *child)
+  {
+    int position = position_after(node, byte);
+    for (int i = node->count; i > position; i--)
+    {
+      node->keys[i] = node->keys[i - 1];
+      node->children[i] = node->children[i - 1];
+    }
+    node->keys[position] = byte;
+    node->children[position] = child;
+    node->count++;
+  }
+
+  template <int Capacity, NodeType Type>
+  static void erase_at(SmallNode<Capacity, Type> *node, int position)
+  {
+    for (int i = position + 1; i < node->count; i++)
+    {
+      node->keys[i - 1] = node->keys[i];
+      node->children[i - 1] = node->children[i];
+    }
+    node->count--;
+  }
+
+  // adds a child for byte, ref is replaced by a bigger node when the node is full
+  static void add_child(Node *&ref, std::uint8_t byte, Node *child)
+  {
+    switch (ref->type)
+    {
+    case node4:
+    {
+      Node4 *small = static_cast<Node4*>(ref);
+      if (small->count < 4)
+      {
+        insert_sorted(small, byte, child);
+        return;
+      }
+      Node16 *grown = new Node16();
+      copy_header(small, grown);
+      std::memcpy(grown->keys, small->keys, 4);
+      std::memcpy(grown->children, small->children, 4 * sizeof(Node*));
+      delete small;
+      ref = grown;
+      insert_sorted(grown, byte, child);
+      return;
+    }
+    case node16:
+    {
+      Node16 *small = static_cast<Node16*>(ref);
+      if (small->count < 16)
+      {
+        insert_sorted(small, byte, child);
+        return;
+      }
+      Node48 *grown = new Node48();
+      copy_header(small, grown);
+      for (int i = 0; i < 16; i++)
+      {
+        grown->index[small->keys[i]] = static_cast<std::uint8_t>(i + 1);
+        grown->children[i] = small->children[i];
+      }
+      delete small;
+      ref = grown;
+      add_child(ref, byte, child);
+      return;
+    }
+    case node48:
+    {
+      Node48 *wide = static_cast<Node48*>(ref);
+      if (wide->count < 48)
+      {
+        int slot = 0;
+        while (wide->children[slot] != nullptr) slot++;
+        wide->children[slot] = child;
+        wide->index[byte] = static_cast<std::uint8_t>(slot + 1);
+        wide->count++;
+        return;
+      }
+      Node256 *grown = new Node256();
+      copy_header(wide, grown);
+      for (int i = 0; i < 256; i++)
+        if (wide->index[i] != 0) grown->children[i] = wide->children[wide->index[i] - 1];
+      delete wide;
+      ref = grown;
+      add_child(ref, byte, child);
+      return;
+    }
+    case node256:
+    {
+      Node256 *full = static_cast<Node256*>(ref);
+      full->children[byte] = child;
+      full->count++;
+      return;
+    }
+    default:
+      return;
+    }
+  }
+
+  // a Node4 left with one child is replaced by it, prefixes are joined
+  static void collapse(Node *&ref)
+  {
+    Node4 *small = static_cast<Node4*>(ref);
+    Node *child = small->children[0];
+    if (!is_leaf(child))
+    {
+      Inner *below = inner(child);
+      std::uint8_t joined[8];
+      int length = 0;
+      for (int i = 0; i < small->prefix_length; i++) joined[length++] = small->prefix[i];
+      joined[length++] = small->keys[0];
+      for (int i = 0; i < below->prefix_length; i++) joined[length++] = below->prefix[i];
+      std::memcpy(below->prefix, joined, length);
+      below->prefix_length = static_cast<std::uint8_t>(length);
+    }
+    delete small;
+    ref = child;
+  }
+
+  // removes the child for byte, ref is replaced by a smaller node when it gets sparse
+  static void remove_child(Node *&ref, std::uint8_t byte, Node **slot)
+  {
+    switch (ref->type)
+    {
+    case node4:
+    {
+      Node4 *small = static_cast<Node4*>(ref);
+      erase_at(small, static_cast<int>(slot - small->children));
+      if (small->count == 1) collapse(ref);
+      return;
+    }
+    case node16:
+    {
+      Node16 *small = static_cast<Node16*>(ref);
+      erase_at(small, static_cast<int>(slot - small->children));
+      if (small->count > 3) return;
+      Node4 *shrunk = new Node4();
+      copy_header(small, shrunk);
+      std::memcpy(shrunk->keys, small->keys, small->count);
+      std::memcpy(shrunk->children, small->children, small->count * sizeof(Node*));
+      delete small;
+      ref = shrunk;
+      return;
+    }
+    case node48:
+    {
+      Node48 *wide = static_cast<Node48*>(ref);
+      *slot = nullptr;
+      wide->index[byte] = 0;
+      wide->count--;
+      if (wide->count > 12) return;
+      Node16 *shrunk = new Node16();
+      copy_header(wide, shrunk);
+      shrunk->count = 0;
+      for (int i = 0; i < 256; i++)
+        if (wide->index[i] != 0)
+        {
+          shrunk->keys[shrunk->count] = static_cast<std::uint8_t>(i);
+          shrunk->children[shrunk->count++] = wide->children[wide->index[i] - 1];
+        }
+      delete wide;
+      ref = shrunk;
+      return;
+    }
+    case node256:
+    {
+      Node256 *full = static_cast<Node256*>(ref);
+      *slot = nullptr;
+      full->count--;
+      if (full->count > 37) return;
+      Node48 *shrunk = new Node48();
+      copy_header(full, shrunk);
+      shrunk->count = 0;
+      for (int i = 0; i < 256; i++)
+        if (full->children[i] != nullptr)
+        {
+          shrunk->children[shrunk->count++] = full->children[i];
+          shrunk->index[i] = static_cast<std::uint8_t>(shrunk->count);
+        }
+      delete full;
+      ref = shrunk;
+      return;
+    }
+    default:
+      return;
+    }
+  }
+
+  // hangs leaf at ref, the place the descent of find_or_insert() stopped at
+  static void insert_leaf(Node *&ref, Leaf *leaf, int depth)
+  {
+    std::uint64_t bits = leaf->bits();
+    if (ref == nullptr)
+    {
+      ref = leaf;
+      return;
+    }
+    if (is_leaf(ref))
+    {
+      // two keys meet: a new node takes their common bytes as its prefix
+      Leaf *other = static_cast<Leaf*>(ref);
+      std::uint64_t other_bits = other->bits();
+      Node4 *node = new Node4();
+      int common = 0;
+      while (byte_at(other_bits, depth + common) == byte_at(bits, depth + common))
+      {
+        node->prefix[common] = byte_at(bits, depth + common);
+        common++;
+      }
+      node->prefix_length = static_cast<std::uint8_t>(common);
+      depth += common;
+      insert_sorted(node, byte_at(other_bits, depth), other);
+      insert_sorted(node, byte_at(bits, depth), leaf);
+      ref = node;
+      return;
+    }
+    Inner *split = inner(ref);
+    int matched = 0;
+    while (matched < split->prefix_length && split->prefix[matched] == byte_at(bits, depth + matched)) matched++;
+    if (matched < split->prefix_length)
+    {
+      // the key leaves the compressed path: split it at the first differing byte
+      Node4 *node = new Node4();
+      node->prefix_length = static_cast<std::uint8_t>(matched);
+      std::memcpy(node->prefix, split->prefix, matched);
+      std::uint8_t old_byte = split->prefix[matched];
+      split->prefix_length = static_cast<std::uint8_t>(split->prefix_length - matched - 1);
+      std::memmove(split->prefix, split->prefix + matched + 1, split->prefix_length);
+      insert_sorted(node, old_byte, ref);
+      insert_sorted(node, byte_at(bits, depth + matched), leaf);
+      ref = node;
+      return;
+    }
+    add_child(ref, byte_at(bits, depth + split->prefix_length), leaf);
+  }
+
+  // takes the leaf with bits out of the tree under ref, nullptr if there is none
+  static Leaf* detach(Node *&ref, std::uint64_t bits, int depth)
+  {
+    if (ref == nullptr) return nullptr;
+    if (is_leaf(ref))
+    {
+      Leaf *leaf = static_cast<Leaf*>(ref);
+      if (leaf->bits() != bits) return nullptr;
+      ref = nullptr;
+      return leaf;
+    }
+    depth += inner(ref)->prefix_length;
+    std::uint8_t byte = byte_at(bits, depth);
+    Node **child = find_child(ref, byte);
+    if (child == nullptr) return nullptr;
+    if (!is_leaf(*child)) return detach(*child, bits, depth + 1);
+    Leaf *leaf = static_cast<Leaf*>(*child);
+    if (leaf->bits() != bits) return nullptr;
+    remove_child(ref, byte, child);
+    return leaf;
+  }
+
+  // prefixes are not compared on the way down, the leaf reached has the full key to check
+  Leaf* lookup(std::uint64_t bits) const
+  {
+    Node *node = root;
+    int depth = 0;
+    while (node != nullptr && !is_leaf(node))
+    {
+      depth += inner(node)->prefix_length;
+      Node **child = find_child(node, byte_at(bits, depth));
+      if (child == nullptr) return nullptr;
+      node = *child;
+      depth++;
+    }
+    if (node == nullptr || static_cast<Leaf*>(node)->bits() != bits) return nullptr;
+    return static_cast<Leaf*>(node);
+  }
+
+  // the leaf of key, a new one when the key is missing. a single descent finds it or the place
+  // it goes, and the leaf that follows it in key order is read off that place: the leaf met
+  // there, the first one right of the path, or the one after everything left of it
+  Leaf* find_or_insert(const key_type& key)
+  {
+    std::uint64_t bits = to_bits(key);
+    Node **ref = &root;
+    int depth = 0;
+    Leaf *next = nullptr;
+    while (*ref != nullptr)
+    {
+      Node *node = *ref;
+      if (is_leaf(node))
+      {
+        Leaf *other = static_cast<Leaf*>(node);
+        std::uint64_t other_bits = other->bits();
+        if (other_bits == bits) return other;
+        next = other_bits > bits ? other : other->next;
+        break;
+      }
+      const Inner *path = inner(node);
+      int matched = 0;
+      while (matched < path->prefix_length && path->prefix[matched] == byte_at(bits, depth + matched)) matched++;
+      if (matched < path->prefix_length)
+      {
+        next = path->prefix[matched] > byte_at(bits, depth + matched) ? min_leaf(node) : max_leaf(node)->next;
+        break;
+      }
+      std::uint8_t byte = byte_at(bits, depth + matched);
+      Node **child = find_child(node, byte);
+      if (child == nullptr)
+      {
+        Node *after = child_after(node, byte);
+        next = after != nullptr ? min_leaf(after) : max_leaf(node)->next;
+        break;
+      }
+      ref = child;
+      depth += matched + 1;
+    }
+    Leaf *leaf = new Leaf(key, mapped_type{});
+    insert_leaf(*ref, leaf, depth);
+    link_before(leaf, next);
+    size++;
+    return leaf;
+  }
+
+  // first leaf not lower than bits in the subtree of node, or the leaf that follows the subtree
+  static Leaf* lower_leaf(const Node *node, std::uint64_t bits, int depth)
+  {
+    if (is_leaf(node))
+    {
+      const Leaf *leaf = static_cast<const Leaf*>(node);
+      return leaf->bits() >= bits ? const_cast<Leaf*>(leaf) : leaf->next;
+    }
+    const Inner *path = inner(node);
+    for (int i = 0; i < path->prefix_length; i++)
+    {
+      std::uint8_t byte = byte_at(bits, depth + i);
+      if (path->prefix[i] > byte) return min_leaf(node);
+      if (path->prefix[i] < byte) return max_leaf(node)->next;
+    }
+    depth += path->prefix_length;
+    std::uint8_t byte = byte_at(bits, depth);
+    Node **child = find_child(const_cast<Node*>(node), byte);
+    if (child != nullptr) return lower_leaf(*child, bits, depth + 1);
+    Node *after = child_after(node, byte);
+    if (after != nullptr) return min_leaf(after);
+    return max_leaf(node)->next;
+  }
+
+  Leaf* lower_leaf(std::uint64_t bits) const
+  {
+    return root != nullptr ? lower_leaf(root, bits, 0) : nullptr;
+  }
+
+  static void free_tree(Node *node)
+  {
+    if (node == nullptr) return;
+    switch (node->type)
+    {
+    case leaf_node:
+      delete static_cast<Leaf*>(node);
+      return;
+    case node4:
+      for (int i = 0; i < inner(node)->count; i++) free_tree(static_cast<Node4*>(node)->children[i]);
+      delete static_cast<Node4*>(node);
+      return;
+    case node16:
+      for (int i = 0; i < inner(node)->count; i++) free_tree(static_cast<Node16*>(node)->children[i]);
+      delete static_cast<Node16*>(node);
+      return;
+    case node48:
+      for (int i = 0; i < 48; i++) free_tree(static_cast<Node48*>(node)->children[i]);
+      delete static_cast<Node48*>(node);
+      return;
+    case node256:
+      for (int i = 0; i < 256; i++) free_tree(static_cast<Node256*>(node)->children[i]);
+      delete static_cast<Node256*>(node);
+      return;
+    }
+  }
+
+  void link_before(Leaf *leaf, Leaf *next)
+  {
+    leaf->next = next;
+    leaf->prev = next != nullptr ? next->prev : tail;
+    if (leaf->prev != nullptr) leaf->prev->next = leaf;
+    else head = leaf;
+    if (next != nullptr) next->prev = leaf;
+    else tail = leaf;
+  }
+
+  void unlink(Leaf *leaf)
+  {
+    if (leaf->prev != nullptr) leaf->prev->next = leaf->next;
+    else head = leaf->next;
+    if (leaf->next != nullptr) leaf->next->prev = leaf->prev;
+    else tail = leaf->prev;
+  }
+
+  void steal(RadixTreeMap& other)
+  {
+    root = other.root;
+    head = other.head;
+    tail = other.tail;
+    size = other.size;
+    other.root = nullptr;
+    other.head = other.tail = nullptr;
+    other.size = 0;
+  }
+
+  // visits leaves from the first not lower than low up to high, both are key images
+  template <typename Function>
+  void scan(std::uint64_t low, std::uint64_t high, Function f) const
+  {
+    for (Leaf *leaf = lower_leaf(low); leaf != nullptr && leaf->bits() <= high; leaf = leaf->next)
+      f(leaf->entry);
+  }
+
+public:
+  RadixTreeMap(): root(nullptr), head(nullptr), tail(nullptr), size(0) {}
+
+  RadixTreeMap(std::initializer_list<value_type> list): RadixTreeMap()
+  {
+    for (auto it = list.begin(); it != list.end(); ++it)
+      (*this)[it->first] = it->second;
+  }
+
+  RadixTreeMap(const RadixTreeMap& other): RadixTreeMap()
+  {
+    for (Leaf *leaf = other.head; leaf != nullptr; leaf = leaf->next)
+      (*this)[leaf->entry.first] = leaf->entry.second;
+  }
+
+  RadixTreeMap(RadixTreeMap&& other)
+  {
+    steal(other);
+  }
+
+  ~RadixTreeMap()
+  {
+    free_tree(root);
+  }
+
+  RadixTreeMap& operator=(const RadixTreeMap& other)
+  {
+    if (this == &other) return *this;
+    RadixTreeMap copy(other);
+    free_tree(root);
+    steal(copy);
+    return *this;
+  }
+
+  RadixTreeMap& operator=(RadixTreeMap&& other)
+  {
+    if (this == &other) return *this;
+    free_tree(root);
+    steal(other);
+    return *this;
+  }
+
+  bool isEmpty() const
+  {
+    return size == 0;
+  }
+
+  size_type getSize() const
+  {
+    return size;
+  }
+
+  mapped_type& operator[](const key_type& key)
+  {
+    return find_or_insert(key)->entry.second;
+  }
+
+  const mapped_type& valueOf(const key_type& key) const
+  {
+    Leaf *leaf = lookup(to_bits(key));
+    if (leaf == nullptr) throw std::out_of_range("such key doesn't exist");
+    return leaf->entry.second;
+  }
+
+  mapped_type& valueOf(const key_type& key)
+  {
+    Leaf *leaf = lookup(to_bits(key));
+    if (leaf == nullptr) throw std::out_of_range("such key doesn't exist");
+    return leaf->entry.second;
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    return ConstIterator(this, lookup(to_bits(key)));
+  }
+
+  iterator find(const key_type& key)
+  {
+    return Iterator(ConstIterator(this, lookup(to_bits(key))));
+  }
+
+  // first entry with a key not lower than key
+  const_iterator lower_bound(const key_type& key) const
+  {
+    return ConstIterator(this, lower_leaf(to_bits(key)));
+  }
+
+  iterator lower_bound(const key_type& key)
+  {
+    return Iterator(ConstIterator(this, lower_leaf(to_bits(key))));
+  }
+
+  // first entry with a key greater than key
+  const_iterator upper_bound(const key_type& key) const
+  {
+    Leaf *leaf = lower_leaf(to_bits(key));
+    if (leaf != nullptr && leaf->entry.first == key) leaf = leaf->next;
+    return ConstIterator(this, leaf);
+  }
+
+  iterator upper_bound(const key_type& key)
+  {
+    return Iterator(static_cast<const RadixTreeMap*>(this)->upper_bound(key));
+  }
+
+  void remove(const key_type& key)
+  {
+    Leaf *leaf = detach(root, to_bits(key), 0);
+    if (leaf == nullptr) throw std::out_of_range("such key doesn't exist");
+    unlink(leaf);
+    delete leaf;
+    size--;
+  }
+
+  void remove(const const_iterator& it)
+  {
+    if (it == cend()) throw std::out_of_range("cannot erase end");
+    remove(it->first);
+  }
+
+  // calls f for every entry with first <= key < last, in key order
+  template <typename Function>
+  void for_each_in_range(const key_type& first, const key_type& last, Function f) const
+  {
+    if (!(first < last)) return;
+    scan(to_bits(first), to_bits(last) - 1, [&](const value_type& entry) { f(entry); });
+  }
+
+  template <typename Function>
+  void for_each_in_range(const key_type& first, const key_type& last, Function f)
+  {
+    if (!(first < last)) return;
+    scan(to_bits(first), to_bits(last) - 1, [&](const value_type& entry) { f(const_cast<value_type&>(entry)); });
+  }
+
+  // calls f for every entry whose key has the same top prefix_bits bits as key, in key order
+  template <typename Function>
+  void for_each_with_prefix(const key_type& key, int prefix_bits, Function f) const
+  {
+    if (prefix_bits < 0 || prefix_bits > 8 * key_bytes) throw std::out_of_range("prefix longer than the key");
+    int free_bits = 8 * key_bytes - prefix_bits;
+    std::uint64_t low_mask = free_bits == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << free_bits) - 1;
+    std::uint64_t bits = to_bits(key);
+    scan(bits & ~low_mask, bits | low_mask, [&](const value_type& entry) { f(entry); });
+  }
+
+  bool operator==(const RadixTreeMap& other) const
+  {
+    if (size != other.size) return false;
+    for (Leaf *mine = head, *theirs = other.head; mine != nullptr; mine = mine->next, theirs = theirs->next)
+      if (mine->entry.first != theirs->entry.first || mine->entry.second != theirs->entry.second) return false;
+    return true;
+  }
+
+  bool operator!=(const RadixTreeMap& other) const
+  {
+    return !(*this == other);
+  }
+
+  iterator begin()
+  {
+    return iterator(cbegin());
+  }
+
+  iterator end()
+  {
+    return iterator(cend());
+  }
+
+  const_iterator cbegin() const
+  {
+    return ConstIterator(this, head);
+  }
+
+  const_iterator cend() const
+  {
+    return ConstIterator(this, nullptr);
+  }
+
+  const_iterator begin() const
+  {
+    return cbegin();
+  }
+
+  const_iterator end() const
+  {
+    return cend();
+  }
+};
+
+template <typename KeyType, typename ValueType>
+class RadixTreeMap<KeyType, ValueType>::ConstIterator
+{
+  friend class RadixTreeMap;
+public:
+  using reference = typename RadixTreeMap::const_reference;
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = typename RadixTreeMap::value_type;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const typename RadixTreeMap::value_type*;
+
+private:
+  const RadixTreeMap *map;
+  Leaf *leaf; // nullptr is end
+
+  ConstIterator(const RadixTreeMap *map, Leaf *leaf): map(map), leaf(leaf) {}
+public:
+  ConstIterator(): map(nullptr), leaf(nullptr) {}
+
+  ConstIterator& operator++()
+  {
+    if (leaf == nullptr) throw std::out_of_range("cannot increment end iterator");
+    leaf = leaf->next;
+    return *this;
+  }
+
+  ConstIterator operator++(int)
+  {
+    ConstIterator it(*this);
+    operator++();
+    return it;
+  }
+
+  ConstIterator& operator--()
+  {
+    Leaf *prev = leaf == nullptr ? map->tail : leaf->prev;
+    if (prev == nullptr) throw std::out_of_range("cannot decrement begin iterator");
+    leaf = prev;
+    return *this;
+  }
+
+  ConstIterator operator--(int)
+  {
+    ConstIterator it(*this);
+    operator--();
+    return it;
+  }
+
+  reference operator*() const
+  {
+    if (leaf == nullptr) throw std::out_of_range("cannot dereference end iterator");
+    return leaf->entry;
+  }
+
+  pointer operator->() const
+  {
+    return &this->operator*();
+  }
+
+  bool operator==(const ConstIterator& other) const
+  {
+    return leaf == other.leaf;
+  }
+
+  bool operator!=(const ConstIterator& other) const
+  {
+    return leaf != other.leaf;
+  }
+};
+
+template <typename KeyType, typename ValueType>
+class RadixTreeMap<KeyType, ValueType>::Iterator : public RadixTreeMap<KeyType, ValueType>::ConstIterator
+{
+public:
+  using reference = typename RadixTreeMap::reference;
+  using pointer = typename RadixTreeMap::value_type*;
+
+  Iterator() {}
+
+  Iterator(const ConstIterator& other): ConstIterator(other) {}
+
+  Iterator& operator++()
+  {
+    ConstIterator::operator++();
+    return *this;
+  }
+
+  Iterator operator++(int)
+  {
+    auto result = *this;
+    ConstIterator::operator++();
+    return result;
+  }
+
+  Iterator& operator--()
+  {
+    ConstIterator::operator--();
+    return *this;
+  }
+
+  Iterator operator--(int)
+  {
+    auto result = *this;
+    ConstIterator::operator--();
+    return result;
+  }
+
+  pointer operator->() const
+  {
+    return &this->operator*();
+  }
+
+  reference operator*() const
+  {
+    return const_cast<reference>(ConstIterator::operator*());
+  }
+};
+
+}
+
+#endif /* AISDI_MAPS_RADIXTREEMAP_H */
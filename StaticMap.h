@@ -0,0 +1,138 @@
+#ifndef AISDI_MAPS_STATICMAP_H
+#define AISDI_MAPS_STATICMAP_H
+
+#include <cstddef>
+#include <stdexcept>
+
+namespace aisdi
+{
+
+// entry of a StaticMap. std::pair cannot be assigned in a constant expression before C++20,
+// so the map keeps its own aggregate with the same member names
+template <typename KeyType, typename ValueType>
+struct StaticEntry
+{
+  KeyType first;
+  ValueType second;
+};
+
+// map over a fixed set of keys built entirely at compile time: the entries are sorted in
+// the constexpr constructor and looked up by binary search. there is no heap allocation
+// and no startup cost, and a lookup of a constant key folds away completely.
+// keys and values must be literal types that can be default constructed
+template <typename KeyType, typename ValueType, std::size_t Count>
+class StaticMap
+{
+  static_assert(Count > 0, "StaticMap needs at least one entry");
+public:
+  using key_type = KeyType;
+  using mapped_type = ValueType;
+  using value_type = StaticEntry<KeyType, ValueType>;
+  using size_type = std::size_t;
+  using const_reference = const value_type&;
+  using const_iterator = const value_type*;
+  using ConstIterator = const_iterator;
+
+private:
+  value_type entries[Count];
+
+  // index of the first entry not lower than key
+  constexpr std::size_t lower_index(const key_type& key) const
+  {
+    std::size_t first = 0, length = Count;
+    while (length > 0)
+    {
+      std::size_t half = length / 2;
+      if (entries[first + half].first < key)
+      {
+        first += half + 1;
+        length -= half + 1;
+      }
+      else length = half;
+    }
+    return first;
+  }
+
+public:
+  constexpr StaticMap(const value_type (&list)[Count]): entries{}
+  {
+    for (std::size_t i = 0; i < Count; i++)
+    {
+      std::size_t position = i;
+      while (position > 0 && list[i].first < entries[position - 1].first)
+      {
+        entries[position] = entries[position - 1];
+        position--;
+      }
+      if (position > 0 && !(entries[position - 1].first < list[i].first))
+        throw std::invalid_argument("duplicate key");
+      entries[position] = list[i];
+    }
+  }
+
+  constexpr bool isEmpty() const
+  {
+    return false;
+  }
+
+  constexpr size_type getSize() const
+  {
+    return Count;
+  }
+
+  constexpr const_iterator find(const key_type& key) const
+  {
+    std::size_t index = lower_index(key);
+    if (index == Count || key < entries[index].first) return end();
+    return entries + index;
+  }
+
+  constexpr bool contains(const key_type& key) const
+  {
+    return find(key) != end();
+  }
+
+  constexpr const mapped_type& valueOf(const key_type& key) const
+  {
+    const_iterator it = find(key);
+    if (it == end()) throw std::out_of_range("such key doesn't exist");
+    return it->second;
+  }
+
+  constexpr const_iterator lower_bound(const key_type& key) const
+  {
+    return entries + lower_index(key);
+  }
+
+  constexpr const_iterator begin() const
+  {
+    return entries;
+  }
+
+  constexpr const_iterator end() const
+  {
+    return entries + Count;
+  }
+
+  constexpr const_iterator cbegin() const
+  {
+    return begin();
+  }
+
+  constexpr const_iterator cend() const
+  {
+    return end();
+  }
+};
+
+// builds a StaticMap from a braced list, e.g.
+// constexpr auto opcodes = make_static_map<int, char>({{0x10, 'a'}, {0x02, 'b'}});
+template <typename KeyType, typename ValueType, std::size_t Count>
+constexpr StaticMap<KeyType, ValueType, Count> make_static_map(const StaticEntry<KeyType, ValueType> (&list)[Count])
+{
+  return StaticMap<KeyType, ValueType, Count>(list);
+}
+
+}
+
+#endif /* AISDI_MAPS_STATICMAP_H */
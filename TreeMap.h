@@ -1,15 +1,23 @@
 #ifndef AISDI_MAPS_TREEMAP_H
 #define AISDI_MAPS_TREEMAP_H
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <initializer_list>
+#include <memory>
+#include <new>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 #include <iostream>
+#include "InlineSlots.h"
+#include "NodeArena.h"
+#include "Parallel.h"
 namespace aisdi
 {
 
-template <typename KeyType, typename ValueType>
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity = 0>
 class TreeMap
 {
 public:
@@ -22,8 +30,11 @@ public:
 
   class ConstIterator;
   class Iterator;
+  class NodeHandle;
+  class Snapshot;
   using iterator = Iterator;
   using const_iterator = ConstIterator;
+  using node_type = NodeHandle;
 
 private:
 
@@ -32,17 +43,556 @@ private:
     public:
     value_type node;
     Node *left, *right, *parent;
+    // number of links to the node from the live tree and from snapshots,
+    // parent is only meaningful for the live tree
+    std::atomic<unsigned> refs;
 
-    Node(): left(nullptr), right(nullptr), parent(nullptr) {}
-    Node(const key_type key, mapped_type value, Node* parent): node(key,value), left(nullptr), right(nullptr), parent(parent) {}
+    Node(): left(nullptr), right(nullptr), parent(nullptr), refs(1) {}
+    Node(const key_type key, mapped_type value, Node* parent): node(key,std::move(value)), left(nullptr), right(nullptr), parent(parent), refs(1) {}
   };
 
+public:
+  // nodes kept inside the map object. none by default, as every slot adds a node to the size
+  // of the map even while it is empty
+  static constexpr std::size_t inline_capacity = InlineCapacity;
+
+private:
   Node *root;
-  int size; // how many elements are stored
+  size_type size; // how many elements are stored
+  detail::InlineSlots<Node, InlineCapacity> slots;
+  bool shared; // set once a snapshot was taken, nodes may then be linked from snapshots too
+  std::shared_ptr<std::atomic<std::size_t>> live_snapshots; // snapshots not destroyed yet, made with the first one
+  // last inserted node, ascending inserts attach to it without a descent while it is the maximum
+  Node *finger;
+  bool finger_is_max;
+  detail::NodeArena<Node> arena; // nodes placed by compact(), on huge pages if asked for
+  Node *compact_next; // next node compact() moves
+  bool compacting;
+
+  // replaces a node shared with snapshots by a private copy, node's parent has to be owned already
+  Node* clone(Node *node)
+  {
+    Node *copied = make_node(node->node.first, node->node.second, node->parent);
+    copied->left = node->left;
+    copied->right = node->right;
+    if (copied->left != nullptr)
+    {
+        copied->left->refs.fetch_add(1, std::memory_order_relaxed);
+        copied->left->parent = copied;
+    }
+    if (copied->right != nullptr)
+    {
+        copied->right->refs.fetch_add(1, std::memory_order_relaxed);
+        copied->right->parent = copied;
+    }
+    transplant(node, copied);
+    // a snapshot may have let go meanwhile, then the live tree held the last link
+    release(node);
+    return copied;
+  }
+
+  // whether nodes may still be linked from snapshots, cleared once the last snapshot is gone
+  bool sharing()
+  {
+    if (shared && live_snapshots->load(std::memory_order_acquire) == 0) shared = false;
+    return shared;
+  }
+
+  // makes node and the path to it private to the live tree, copying only the shared part of the path.
+  // with owned given, the path above it is known to be private and only the part below is looked at.
+  // returns the node now holding the entry
+  Node* own(Node *node, Node *owned = nullptr)
+  {
+    if (node == nullptr || !sharing()) return node;
+    Node *top = nullptr;
+    for (Node *current = node; current != owned; current = current->parent)
+        if (current->refs.load(std::memory_order_acquire) > 1) top = current;
+    if (top == nullptr) return node;
+
+    const key_type key = node->node.first; // node is freed once cloned if no snapshot holds it any more
+    Node *current = top;
+    while (true)
+    {
+        if (current->refs.load(std::memory_order_acquire) > 1) current = clone(current);
+        if (current->node.first == key) return current;
+        if (key > current->node.first) current = current->right;
+        else current = current->left;
+    }
+  }
+
+  // copies everything the live tree still shares with snapshots
+  void own_all()
+  {
+    if (!sharing()) return;
+    std::vector<Node*> pending;
+    if (root != nullptr) pending.push_back(root);
+    while (!pending.empty())
+    {
+        Node *current = pending.back();
+        pending.pop_back();
+        if (current->refs.load(std::memory_order_acquire) > 1) current = clone(current);
+        if (current->left != nullptr) pending.push_back(current->left);
+        if (current->right != nullptr) pending.push_back(current->right);
+    }
+    shared = false;
+  }
+
+  // drops one link to a subtree of heap nodes, freeing whatever is no longer referenced
+  static void release(Node *tree)
+  {
+    std::vector<Node*> pending;
+    if (tree != nullptr) pending.push_back(tree);
+    while (!pending.empty())
+    {
+        Node *current = pending.back();
+        pending.pop_back();
+        if (current->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+        if (current->left != nullptr) pending.push_back(current->left);
+        if (current->right != nullptr) pending.push_back(current->right);
+        delete current;
+    }
+  }
+
+  bool is_inline(const Node *node) const
+  {
+    return slots.owns(node);
+  }
+
+  Node* make_node(const key_type& key, mapped_type value, Node *parent)
+  {
+    void *memory = slots.allocate();
+    if (memory != nullptr) return new (memory) Node(key, std::move(value), parent);
+    return new Node(key, std::move(value), parent);
+  }
+
+  bool in_arena(const Node *node) const
+  {
+    return !arena.empty() && arena.owns(node);
+  }
+
+  size_type heap_nodes() const
+  {
+    return size - slots.count();
+  }
+
+  void free_node(Node *node)
+  {
+    if (is_inline(node))
+    {
+        node->~Node();
+        slots.deallocate(node);
+    }
+    else if (in_arena(node))
+    {
+        node->~Node();
+        arena.deallocate(node);
+    }
+    else delete node;
+  }
+
+  // moves a node to memory at target, keeping its position in the tree
+  Node* relocate(Node *node, void *target)
+  {
+    Node *moved = new (target) Node(node->node.first, std::move(node->node.second), node->parent);
+    moved->left = node->left;
+    moved->right = node->right;
+    transplant(node, moved);
+    if (moved->left != nullptr) moved->left->parent = moved;
+    if (moved->right != nullptr) moved->right->parent = moved;
+    if (finger == node) finger = moved;
+    if (compact_next == node) compact_next = moved;
+    node->~Node();
+    return moved;
+  }
+
+  // moves a linked heap or arena node to the block compact() fills, false if the block is full
+  bool move_to_arena(Node *node)
+  {
+    void *target = arena.allocate();
+    if (target == nullptr) return false;
+    bool from_arena = arena.owns(node);
+    relocate(node, target);
+    if (from_arena) arena.deallocate(node);
+    else ::operator delete(node);
+    return true;
+  }
+
+  // whether the heap nodes fill one arena block in key order, as a compaction leaves them
+  // when nothing is written while it runs
+  bool laid_out() const
+  {
+    if (!arena.packed(heap_nodes())) return false;
+    std::size_t index = 0;
+    for (Node *node = (root != nullptr) ? minimum(root) : nullptr; node != nullptr; node = successor(node))
+        if (!is_inline(node) && !arena.at(node, index++)) return false;
+    return true;
+  }
+
+  // moves nodes out of the inline storage and the arena, used before handing whole subtrees
+  // to another map or to snapshots, which free them one by one
+  void evacuate_inline()
+  {
+    for (std::size_t slot = 0; slot < inline_capacity; slot++)
+        if (slots.occupied(slot)) relocate(slots.at(slot), ::operator new(sizeof(Node)));
+    slots.clear();
+    if (arena.empty()) return;
+    for (Node *node = (root != nullptr) ? minimum(root) : nullptr, *next; node != nullptr; node = next)
+    {
+        next = successor(node);
+        if (!arena.owns(node)) continue;
+        relocate(node, ::operator new(sizeof(Node)));
+        arena.deallocate(node);
+    }
+    arena.release_all();
+    compacting = false;
+  }
+
+  // returns a detached heap node with the contents of node
+  Node* to_heap(Node *node)
+  {
+    if (!is_inline(node) && !in_arena(node)) return node;
+    Node *moved = new Node(node->node.first, std::move(node->node.second), nullptr);
+    free_node(node);
+    return moved;
+  }
+
+  // takes all nodes of other, inline ones are moved to the inline storage here
+  void steal(TreeMap& other)
+  {
+    root = other.root;
+    size = other.size;
+    shared = other.shared;
+    live_snapshots = other.live_snapshots;
+    finger = nullptr;
+    other.finger = nullptr;
+    arena = std::move(other.arena);
+    compacting = false;
+    other.compacting = false;
+    for (std::size_t slot = 0; slot < inline_capacity; slot++)
+        if (other.slots.occupied(slot)) relocate(other.slots.at(slot), slots.allocate());
+    other.slots.clear();
+    other.root = nullptr;
+    other.size = 0;
+    other.shared = false;
+  }
+
+  Node* locate(const key_type& key) const
+  {
+    Node *current = root;
+    while (current!= nullptr && current->node.first != key)
+    {
+       if (key > current->node.first) current = current->right;
+        else current = current->left;
+    }
+    return current;
+  }
+
+  static Node* minimum(Node *node)
+  {
+    while (node->left != nullptr) node = node->left;
+    return node;
+  }
+
+  static Node* maximum(Node *node)
+  {
+    while (node->right != nullptr) node = node->right;
+    return node;
+  }
+
+  // puts replacement (may be null) in place of node in node's parent
+  void transplant(Node *node, Node *replacement)
+  {
+    if (node->parent == nullptr) root = replacement;
+    else if (node->parent->left == node) node->parent->left = replacement;
+    else node->parent->right = replacement;
+    if (replacement != nullptr) replacement->parent = node->parent;
+  }
+
+  // detaches node from the tree without touching its value, the node is not freed.
+  // returns the detached node, which differs from node if node was shared with a snapshot
+  Node* unlink(Node *node)
+  {
+    if (node == finger) finger = nullptr;
+    if (node == compact_next) compact_next = successor(node);
+    node = own(node);
+    if (node->left == nullptr) transplant(node, node->right);
+    else if (node->right == nullptr) transplant(node, node->left);
+    else
+    {
+        Node *next = own(minimum(node->right));
+        if (next->parent != node)
+        {
+            transplant(next, next->right);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+        transplant(node, next);
+        next->left = node->left;
+        next->left->parent = next;
+    }
+    node->left = node->right = node->parent = nullptr;
+    size--;
+    return node;
+  }
+
+  // links a detached node under its place in the tree unless the key is already there,
+  // returns the node holding the key
+  Node* link(Node *node)
+  {
+    const key_type& key = node->node.first;
+    Node *current = root;
+    Node *saved_parent = nullptr;
+    bool rightmost = true;
+    while (current != nullptr)
+    {
+        saved_parent = current;
+        if (current->node.first == key) return current;
+        if (key > current->node.first) current = current->right;
+        else
+        {
+            current = current->left;
+            rightmost = false;
+        }
+    }
+    saved_parent = own(saved_parent);
+    node->parent = saved_parent;
+    size++;
+    if (saved_parent == nullptr) root = node;
+    else if (key > saved_parent->node.first) saved_parent->right = node;
+    else saved_parent->left = node;
+    finger = node;
+    finger_is_max = rightmost;
+    return node;
+  }
+
+  // splits the tree at tree into nodes with keys lower than key and the rest
+  static std::pair<Node*, Node*> split(Node *tree, const key_type& key)
+  {
+    Node *lower = nullptr, *upper = nullptr;
+    Node **lower_slot = &lower, **upper_slot = &upper;
+    Node *lower_parent = nullptr, *upper_parent = nullptr;
+    while (tree != nullptr)
+    {
+        if (tree->node.first < key)
+        {
+            *lower_slot = tree;
+            tree->parent = lower_parent;
+            lower_parent = tree;
+            lower_slot = &tree->right;
+            tree = tree->right;
+        }
+        else
+        {
+            *upper_slot = tree;
+            tree->parent = upper_parent;
+            upper_parent = tree;
+            upper_slot = &tree->left;
+            tree = tree->left;
+        }
+    }
+    *lower_slot = nullptr;
+    *upper_slot = nullptr;
+    return std::make_pair(lower, upper);
+  }
+
+  // tree has to be detached (its root has no parent)
+  static size_type count(Node *tree)
+  {
+    size_type counted = 0;
+    if (tree == nullptr) return 0;
+    for (Node *node = minimum(tree); node != nullptr; node = successor(node))
+        counted++;
+    return counted;
+  }
+
+  // links a detached node between two neighbouring nodes (either may be null),
+  // one of the free child slots between them is always the right place
+  void link_between(Node *prev, Node *next, Node *node)
+  {
+    if (next != nullptr && next->left == nullptr)
+    {
+        next->left = node;
+        node->parent = next;
+    }
+    else if (prev != nullptr)
+    {
+        prev->right = node;
+        node->parent = prev;
+    }
+    else
+    {
+        root = node;
+        node->parent = nullptr;
+    }
+    size++;
+    finger = node;
+    finger_is_max = (next == nullptr);
+  }
+
+  // builds a balanced subtree out of detached nodes sorted by key, from nodes[first, last)
+  static Node* build(std::vector<Node*>& nodes, size_type first, size_type last, Node *parent)
+  {
+    if (first == last) return nullptr;
+    size_type middle = first + (last - first) / 2;
+    Node *node = nodes[middle];
+    node->parent = parent;
+    node->left = build(nodes, first, middle, node);
+    node->right = build(nodes, middle + 1, last, node);
+    return node;
+  }
+
+  // pieces of the tree for a parallel scan. either subtrees below a cut, with the nodes above
+  // the cut in tops, or runs of nodes in key order, each from one of starts to the next
+  struct Partition
+  {
+    std::vector<Node*> tops;
+    std::vector<Node*> subtrees;
+    std::vector<Node*> starts;
+
+    std::size_t tasks() const
+    {
+        return starts.empty() ? subtrees.size() + 1 : starts.size();
+    }
+  };
+
+  static constexpr int partition_depth = 64; // a path this long means the tree is too lopsided to cut
+
+  // whether a subtree has a left or right spine of partition_depth nodes, as sorted input leaves
+  static bool lopsided(const Node *tree)
+  {
+    const Node *left = tree, *right = tree;
+    for (int depth = 0; depth < partition_depth; depth++)
+    {
+        if (left == nullptr && right == nullptr) return false;
+        if (left != nullptr) left = left->left;
+        if (right != nullptr) right = right->right;
+    }
+    return true;
+  }
+
+  // cuts the tree into subtrees of about equal size. when that fails because the tree is lopsided,
+  // as after sorted inserts or a copy, one walk in key order picks ranges of equal length instead
+  Partition partition(unsigned threads) const
+  {
+    Partition result;
+    std::size_t wanted = detail::worker_count(threads) * 8;
+    std::vector<Node*> next;
+    bool split = true;
+    int depth = 0;
+    if (root != nullptr) result.subtrees.push_back(root);
+    for (; depth < partition_depth && split && result.subtrees.size() < wanted; depth++)
+    {
+        split = false;
+        next.clear();
+        for (Node *node : result.subtrees)
+        {
+            if (node->left == nullptr && node->right == nullptr)
+            {
+                next.push_back(node);
+                continue;
+            }
+            split = true;
+            result.tops.push_back(node);
+            if (node->left != nullptr) next.push_back(node->left);
+            if (node->right != nullptr) next.push_back(node->right);
+        }
+        if (split) result.subtrees.swap(next);
+    }
+    bool even = depth < partition_depth;
+    for (std::size_t i = 0; i < result.subtrees.size() && even; i++) even = !lopsided(result.subtrees[i]);
+    if (even || size < wanted) return result;
+
+    result.tops.clear();
+    result.subtrees.clear();
+    size_type length = size / wanted, position = 0;
+    for (Node *node = minimum(root); node != nullptr; node = successor(node), position++)
+        if (position % length == 0 && result.starts.size() < wanted) result.starts.push_back(node);
+    return result;
+  }
+
+  // calls visit on every node of a subtree of the live tree, follows parent links so needs no stack
+  template <typename Visit>
+  static void traverse(Node *tree, Visit visit)
+  {
+    Node *stop = tree->parent, *previous = stop, *current = tree, *next;
+    while (current != stop)
+    {
+        if (previous == current->parent)
+        {
+            visit(current);
+            if (current->left != nullptr) next = current->left;
+            else if (current->right != nullptr) next = current->right;
+            else next = current->parent;
+        }
+        else if (previous == current->left && current->right != nullptr) next = current->right;
+        else next = current->parent;
+        previous = current;
+        current = next;
+    }
+  }
+
+  // runs visit(task, node) over a partition, for a cut task 0 takes the nodes above it
+  template <typename Visit>
+  static void parallel_visit(const Partition& parts, unsigned threads, Visit visit)
+  {
+    detail::parallel_run(parts.tasks(), threads, [&](std::size_t task)
+    {
+        if (!parts.starts.empty())
+        {
+            Node *stop = task + 1 < parts.starts.size() ? parts.starts[task + 1] : nullptr;
+            for (Node *node = parts.starts[task]; node != stop; node = successor(node)) visit(task, node);
+        }
+        else if (task == 0)
+        {
+            for (Node *node : parts.tops) visit(task, node);
+        }
+        else traverse(parts.subtrees[task - 1], [&](Node *node) { visit(task, node); });
+    });
+  }
+
+  static Node* successor(Node *node)
+  {
+    if (node->right != nullptr) return minimum(node->right);
+    while (node->parent != nullptr && node->parent->right == node)
+        node = node->parent;
+    return node->parent;
+  }
+
+  static Node* predecessor(Node *node)
+  {
+    if (node->left != nullptr) return maximum(node->left);
+    while (node->parent != nullptr && node->parent->left == node)
+        node = node->parent;
+    return node->parent;
+  }
+
+  // node holding key, which is added with value unless present. when the key falls right
+  // before next (null for the end) the node is linked there without searching from the root
+  Node* insert_before(Node *next, const key_type& key, mapped_type value)
+  {
+    if (!sharing())
+    {
+        Node *prev;
+        if (next != nullptr) prev = predecessor(next);
+        else if (finger != nullptr && finger_is_max) prev = finger;
+        else prev = (root != nullptr) ? maximum(root) : nullptr;
+        if (prev != nullptr && prev->node.first == key) return prev;
+        if (next != nullptr && next->node.first == key) return next;
+        if ((prev == nullptr || key > prev->node.first) && (next == nullptr || next->node.first > key))
+        {
+            Node *node = make_node(key, std::move(value), nullptr);
+            link_between(prev, next, node);
+            return node;
+        }
+    }
+    Node *found = locate(key);
+    if (found != nullptr) return own(found);
+    return link(make_node(key, std::move(value), nullptr));
+  }
 
 public:
 
-  TreeMap(): root(nullptr), size(0) {}
+  TreeMap(): root(nullptr), size(0), shared(false), finger(nullptr), finger_is_max(false), compact_next(nullptr), compacting(false) {}
 
 
   TreeMap(std::initializer_list<value_type> list): TreeMap()
@@ -51,28 +601,25 @@ public:
         (*this)[it->first] = it->second;
   }
 
+  // entries come in order, so each one is appended next to the previous one
   TreeMap(const TreeMap& other) :TreeMap()
   {
-    for (Iterator it = other.begin(); it != other.end(); it++)
-        (*this)[it.node->node.first] = it.node->node.second;
+    for (ConstIterator it = other.begin(); it != other.end(); it++)
+        insert_before(nullptr, it->first, it->second);
   }
 
-  TreeMap(TreeMap&& other)
+  TreeMap(TreeMap&& other): compact_next(nullptr)
   {
-     size = other.size;
-     root = other.root;
-     other.root = nullptr;
-     other.size = 0;
-
+     steal(other);
   }
 
   TreeMap& operator=(const TreeMap& other)
   {
-      if (*this == other)
+      if (this == &other)
                 return *this;
     clear(root);
-    for (Iterator it = other.begin(); it != other.end(); it++)
-        (*this)[it.node->node.first] = it.node->node.second;
+    for (ConstIterator it = other.begin(); it != other.end(); it++)
+        insert_before(nullptr, it->first, it->second);
 
             return *this;
 
@@ -81,16 +628,11 @@ public:
   TreeMap& operator=(TreeMap&& other)
   {
 
-    if (*this == other)
+    if (this == &other)
             return *this;
 
      clear(root);
-
-     size = other.size;
-     root = other.root;
-
-     other.root = nullptr;
-     other.size = 0;
+     steal(other);
           return *this;
 
   }
@@ -106,14 +648,25 @@ public:
     Node *current = root;
     Node *saved_parent = nullptr;
     Node *new_node;
+    bool rightmost = true;
+    if (finger != nullptr && finger_is_max && key > finger->node.first && !sharing())
+    {
+        current = nullptr; // appending, the finger has no right child
+        saved_parent = finger;
+    }
     while (current != nullptr)
     {
         saved_parent = current;
-        if (current->node.first == key) return current->node.second;
+        if (current->node.first == key) return own(current)->node.second;
         if (key > current->node.first) current = current->right;
-        else current = current->left;
+        else
+        {
+            current = current->left;
+            rightmost = false;
+        }
     }
-    new_node = new Node(key, mapped_type{}, saved_parent);
+    saved_parent = own(saved_parent);
+    new_node = make_node(key, mapped_type{}, saved_parent);
 
     size++;
     if (saved_parent == nullptr)root = new_node;
@@ -123,10 +676,27 @@ public:
             saved_parent->right = new_node;
         else saved_parent->left = new_node;
     }
+    finger = new_node;
+    finger_is_max = rightmost;
     return new_node->node.second;
 
   }
 
+  // inserts value right before hint if that is where its key belongs, which takes O(1) for
+  // ascending keys with the end hint; otherwise the key is looked up from the root.
+  // returns the entry with the key, an existing entry keeps its value
+  iterator insert(const const_iterator& hint, const value_type& value)
+  {
+    return iterator(ConstIterator(this, insert_before(hint.node, value.first, value.second)));
+  }
+
+  template <typename... Args>
+  iterator emplace_hint(const const_iterator& hint, Args&&... args)
+  {
+    value_type value(std::forward<Args>(args)...);
+    return iterator(ConstIterator(this, insert_before(hint.node, value.first, std::move(value.second))));
+  }
+
   const mapped_type& valueOf(const key_type& key) const
   {
     Node *current = root;
@@ -144,7 +714,7 @@ public:
     Node *current = root;
     while (current!= nullptr)
     {
-        if (current->node.first == key) return current->node.second;
+        if (current->node.first == key) return own(current)->node.second;
         if (key > current->node.first) current = current->right;
         else current = current->left;
     }
@@ -153,122 +723,117 @@ public:
 
   const_iterator find(const key_type& key) const
   {
-    Node *current = root;
-    while (current!= nullptr && current->node.first != key)
-    {
-       if (key > current->node.first) current = current->right;
-        else current = current->left;
-    }
-   return const_iterator(this, current);
+   return const_iterator(this, locate(key));
   }
 
   iterator find(const key_type& key)
   {
-    Node *current = root;
-    while (current!= nullptr && current->node.first != key)
-    {
-       if (key > current->node.first) current = current->right;
-        else current = current->left;
-    }
-   return iterator(ConstIterator(this, current));
+   return iterator(ConstIterator(this, locate(key)));
   }
 
   void remove(const key_type& key)
   {
-    Iterator it = begin();
-    Iterator Next;
-    Node *current, *saved_parent = nullptr;
-    for (; it != end(); it++)
-    {
-       current = it.node;
-       if (current != root) saved_parent = current->parent;
-
-       if ( current->node.first == key)
-       {
-
-
-          if (current->left == nullptr && current->right == nullptr)
-          {
-            if (current == root) {root = nullptr; delete current; size--; return;}
-            if (saved_parent->node.first < key) saved_parent-> right = nullptr;
-            else saved_parent->left = nullptr;
-            size--;
-            delete current;
-            return;
-          }
-
-        if (current->left == nullptr && current->right != nullptr )
-          {
-             if (current == root) {root = current->right; delete current; size--; return;}
-             if (saved_parent->node.first < key) saved_parent-> right = current->right;
-             else saved_parent->left = current->right;
-             size--;
-             delete current;
-             return;
-          }
-
-        if (current->left != nullptr && current->right == nullptr )
-          {
-             if (current == root) {root = current->left; delete current; size--; return;}
-             if (saved_parent->node.first < key) saved_parent-> right = current->left;
-             else saved_parent->left = current->left;
-             size--;
-             delete current;
-             return;
-          }
-
-        if (current->left != nullptr && current->right != nullptr)
-        {
-            Next = it++;
-            Node *next = Next.node;
+    Node *current = locate(key);
+    if (current == nullptr) throw std::out_of_range("given key doesn't exist");
+    free_node(unlink(current));
+  }
 
-            Node *copied = new Node (next->node.first, next->node.second, current->parent);
-            if (current == root)
-            {
+  void remove(const const_iterator& it)
+  {
+    if (it == cend()) throw std::out_of_range("there is no such element");
+    free_node(unlink(it.node));
+  }
 
-            copied->left = root->left;
-            copied->right = root->right;
-            root = copied;
-            copied->left->parent = root;
-            copied->right->parent = root;
+  node_type extract(const key_type& key)
+  {
+    Node *current = locate(key);
+    if (current == nullptr) return node_type();
+    return node_type(to_heap(unlink(current)));
+  }
 
-            delete current;
-            size--;
-            return;
-            }
-            if (saved_parent->node.first < key) saved_parent-> right = copied;
-            else saved_parent->left = copied;
-            copied->left = current->left;
-            copied->right = current->right;
-
-          if (next->left == nullptr && next->right != nullptr )
-          {
-             if (next->parent->node.first < key) next->parent-> right = next->right;
-             else next->parent->left = next->right;
-             delete next;
-          }
-
-        else if (next->left != nullptr && next->right == nullptr )
-          {
-             if (next->parent->node.first < key) next->parent-> right = next->left;
-             else next->parent->left = next->left;
-             delete next;
-          }
-        size--;
+  // entries kept in the inline storage are moved to a heap node
+  node_type extract(const const_iterator& it)
+  {
+    if (it == cend()) throw std::out_of_range("there is no such element");
+    return node_type(to_heap(unlink(it.node)));
+  }
+
+  // on a key collision the handle keeps its node and the existing entry is returned
+  std::pair<iterator, bool> insert(node_type&& handle)
+  {
+    if (handle.empty()) return std::make_pair(iterator(cend()), false);
+    Node *linked = link(handle.node);
+    bool inserted = (linked == handle.node);
+    if (inserted) handle.node = nullptr;
+    return std::make_pair(iterator(ConstIterator(this, linked)), inserted);
+  }
+
+  // moves every node whose key is not present here, nodes are relinked, not copied.
+  // parts of other lying below or above all keys of this map are joined as whole subtrees
+  void merge(TreeMap& other)
+  {
+    if (&other == this || other.root == nullptr) return;
+    other.own_all();
+    other.evacuate_inline();
+    finger = nullptr; // subtrees of other may be hung above the maximum
+    if (root == nullptr)
+    {
+        root = other.root;
+        size = other.size;
+        other.root = nullptr;
+        other.size = 0;
         return;
+    }
+
+    Node *lowest = own(minimum(root)), *highest = own(maximum(root));
+    std::pair<Node*, Node*> parts = split(other.root, lowest->node.first);
+    Node *below = parts.first;
+    parts = split(parts.second, highest->node.first);
+    Node *middle = parts.first, *above = parts.second;
+    // highest itself belongs to the overlapping part
+    if (above != nullptr && minimum(above)->node.first == highest->node.first)
+    {
+        Node *duplicate = minimum(above);
+        if (duplicate->parent == nullptr) above = duplicate->right;
+        else duplicate->parent->left = duplicate->right;
+        if (duplicate->right != nullptr) duplicate->right->parent = duplicate->parent;
+        duplicate->right = duplicate->parent = nullptr;
+        if (middle == nullptr) middle = duplicate;
+        else
+        {
+            Node *last = maximum(middle);
+            last->right = duplicate;
+            duplicate->parent = last;
         }
-       }
+    }
 
+    other.root = middle;
+    size_type middle_size = count(middle);
+    size_type joined = other.size - middle_size;
+    other.size = middle_size;
+    if (below != nullptr)
+    {
+        lowest->left = below;
+        below->parent = lowest;
     }
-    throw std::out_of_range("given key doesn't exist");
-  }
+    if (above != nullptr)
+    {
+        highest->right = above;
+        above->parent = highest;
+    }
+    size += joined;
 
-  void remove(const const_iterator& it)
-  {
-    if (it == end()) throw std::out_of_range("there is no such element");
-    key_type key = it.node->node.first;
-    remove(key);
-    return;
+    Node *current = (middle != nullptr) ? minimum(middle) : nullptr;
+    Node *next;
+    while (current != nullptr)
+    {
+        next = successor(current);
+        if (locate(current->node.first) == nullptr)
+        {
+            link(other.unlink(current));
+        }
+        current = next;
+    }
   }
 
   size_type getSize() const
@@ -278,11 +843,12 @@ public:
 
   bool operator ==(const TreeMap& other) const
   {
+     if (this == &other) return true;
      if (size != other.size) return false;
-     Iterator it = begin();
-     Iterator other_it = other.begin();
-     for (; it != end(); it++, other_it++)
-        if (it.node->node != other_it.node->node) return false;
+     if (root == nullptr) return true;
+     Node *mine = minimum(root), *theirs = minimum(other.root);
+     for (; mine != nullptr; mine = successor(mine), theirs = successor(theirs))
+        if (mine->node != theirs->node) return false;
     return true;
   }
 
@@ -291,6 +857,204 @@ public:
     return !(*this == other);
   }
 
+  // adds entries of other whose keys are missing here, existing values are kept.
+  // both trees are walked in order, so every new node is linked next to its neighbour
+  void union_with(const TreeMap& other)
+  {
+    if (this == &other || other.root == nullptr) return;
+    own_all();
+    Node *mine = (root != nullptr) ? minimum(root) : nullptr, *prev = nullptr, *added;
+    for (Node *theirs = minimum(other.root); theirs != nullptr; theirs = successor(theirs))
+    {
+        while (mine != nullptr && theirs->node.first > mine->node.first)
+        {
+            prev = mine;
+            mine = successor(mine);
+        }
+        if (mine != nullptr && mine->node.first == theirs->node.first) continue;
+        added = make_node(theirs->node.first, theirs->node.second, nullptr);
+        link_between(prev, mine, added);
+        prev = added;
+    }
+  }
+
+  // removes entries whose keys are missing in other
+  void intersect_with(const TreeMap& other)
+  {
+    if (this == &other || root == nullptr) return;
+    own_all();
+    Node *theirs = (other.root != nullptr) ? minimum(other.root) : nullptr, *next;
+    for (Node *mine = minimum(root); mine != nullptr; mine = next)
+    {
+        next = successor(mine);
+        while (theirs != nullptr && mine->node.first > theirs->node.first)
+            theirs = successor(theirs);
+        if (theirs == nullptr || theirs->node.first != mine->node.first)
+        {
+            free_node(unlink(mine));
+        }
+    }
+  }
+
+  // entries of this map whose keys are missing in other
+  TreeMap difference(const TreeMap& other) const
+  {
+    TreeMap result;
+    if (this == &other || root == nullptr) return result;
+    std::vector<Node*> kept;
+    Node *theirs = (other.root != nullptr) ? minimum(other.root) : nullptr;
+    for (Node *mine = minimum(root); mine != nullptr; mine = successor(mine))
+    {
+        while (theirs != nullptr && mine->node.first > theirs->node.first)
+            theirs = successor(theirs);
+        if (theirs == nullptr || theirs->node.first != mine->node.first)
+            kept.push_back(result.make_node(mine->node.first, mine->node.second, nullptr));
+    }
+    result.root = build(kept, 0, kept.size(), nullptr);
+    result.size = kept.size();
+    return result;
+  }
+
+  struct Diff
+  {
+    std::vector<key_type> added; // present only in the other map
+    std::vector<key_type> removed; // present only in this map
+    std::vector<key_type> changed; // present in both with different values
+  };
+
+  // describes how to get from this map to other, keys come out sorted
+  Diff diff(const TreeMap& other) const
+  {
+    Diff result;
+    Node *mine = (root != nullptr) ? minimum(root) : nullptr;
+    Node *theirs = (other.root != nullptr) ? minimum(other.root) : nullptr;
+    while (mine != nullptr || theirs != nullptr)
+    {
+        if (theirs == nullptr || (mine != nullptr && theirs->node.first > mine->node.first))
+        {
+            result.removed.push_back(mine->node.first);
+            mine = successor(mine);
+        }
+        else if (mine == nullptr || mine->node.first > theirs->node.first)
+        {
+            result.added.push_back(theirs->node.first);
+            theirs = successor(theirs);
+        }
+        else
+        {
+            if (mine->node.second != theirs->node.second) result.changed.push_back(mine->node.first);
+            mine = successor(mine);
+            theirs = successor(theirs);
+        }
+    }
+    return result;
+  }
+
+  // calls f on every entry, parts of the tree are spread over threads (0 means all cores).
+  // f runs concurrently and the entries come in no particular order
+  template <typename Function>
+  void parallel_for_each(Function f, unsigned threads = 0) const
+  {
+    parallel_visit(partition(threads), threads, [&](std::size_t, Node *node) { f(static_cast<const_reference>(node->node)); });
+  }
+
+  template <typename Function>
+  void parallel_for_each(Function f, unsigned threads = 0)
+  {
+    own_all();
+    parallel_visit(partition(threads), threads, [&](std::size_t, Node *node) { f(node->node); });
+  }
+
+  // folds every part of the tree with op(accumulated, entry) starting from identity,
+  // then folds the partial results with combine
+  template <typename T, typename Operation, typename Combine>
+  T parallel_reduce(T identity, Operation op, Combine combine, unsigned threads = 0) const
+  {
+    Partition parts = partition(threads);
+    std::vector<T> partial(parts.tasks(), identity);
+    parallel_visit(parts, threads, [&](std::size_t task, Node *node)
+    {
+        partial[task] = op(std::move(partial[task]), static_cast<const_reference>(node->node));
+    });
+    T result = identity;
+    for (auto& value : partial) result = combine(std::move(result), std::move(value));
+    return result;
+  }
+
+  // removes entries matching pred, which is evaluated in parallel. the tree itself is
+  // relinked afterwards on the calling thread. returns how many entries were removed
+  template <typename Predicate>
+  size_type parallel_erase_if(Predicate pred, unsigned threads = 0)
+  {
+    own_all();
+    Partition parts = partition(threads);
+    std::vector<std::vector<Node*>> matched(parts.tasks());
+    parallel_visit(parts, threads, [&](std::size_t task, Node *node)
+    {
+        if (pred(static_cast<const_reference>(node->node))) matched[task].push_back(node);
+    });
+    size_type count = 0;
+    for (auto& nodes : matched)
+        for (Node *node : nodes)
+        {
+            free_node(unlink(node));
+            count++;
+        }
+    return count;
+  }
+
+  // moves the nodes into one contiguous block in key order, so in-order scans and lookups touch
+  // neighbouring memory again, memory of the old layout is returned as it empties. inline nodes
+  // stay where they are and nothing is moved while snapshots share the tree. works for at most
+  // budget and returns true once done, a later call carries on from where this one stopped
+  bool compact(std::chrono::nanoseconds budget = std::chrono::nanoseconds::max())
+  {
+    using clock = std::chrono::steady_clock;
+    bool bounded = budget != std::chrono::nanoseconds::max();
+    clock::time_point deadline = bounded ? clock::now() + budget : clock::time_point::max();
+    if (sharing()) return true;
+    if (!compacting)
+    {
+        if (root == nullptr || laid_out()) return true;
+        arena.start_block(heap_nodes());
+        compact_next = minimum(root);
+        compacting = true;
+    }
+    size_type work = 0;
+    while (true)
+    {
+        while (compact_next != nullptr)
+        {
+            Node *node = compact_next;
+            compact_next = successor(node);
+            if (!is_inline(node) && !arena.in_current(node) && !move_to_arena(node)) break;
+            if (++work % 64 == 0 && bounded && clock::now() >= deadline && compact_next != nullptr) return false;
+        }
+        // writes between the steps of a budgeted compaction may have left nodes behind, out
+        // of order or with gaps between them, then they are moved once more
+        if (laid_out()) break;
+        arena.start_block(heap_nodes());
+        compact_next = (root != nullptr) ? minimum(root) : nullptr;
+    }
+    compacting = false;
+    return true;
+  }
+
+  void shrink_to_fit()
+  {
+    compact();
+  }
+
+  // backs the blocks compact() moves nodes into with huge pages where the system offers them,
+  // so a scan over a very large map does not thrash the tlb. takes effect on the next compact()
+  void use_huge_pages(bool enabled)
+  {
+    arena.use_huge_pages(enabled);
+  }
+
+  // while snapshots share the tree, a mutable iterator copies the shared part of the path to each
+  // entry it is placed on, so writes through it never reach a snapshot and other writes never copy
+  // its entry away. taking a snapshot invalidates the mutable iterators obtained before it
   iterator begin()
   {
    return iterator(cbegin());
@@ -331,36 +1095,271 @@ public:
         }
 
 
+        // frees the whole subtree of pRoot, parts shared with snapshots are only released
         void clear(Node* pRoot) {
             if (pRoot == nullptr)
                 return;
 
-            clear(pRoot->left);
-            clear(pRoot->right);
-
-            if (pRoot->left != nullptr) {
-                --size;
-                delete pRoot->left;
-                pRoot->left = nullptr;
-            }
-
-            if (pRoot->right != nullptr) {
-                --size;
-                delete pRoot->right;
-                pRoot->right = nullptr;
+            if (pRoot == root) size = 0;
+            else size -= count(pRoot);
+            finger = nullptr;
+            compacting = false;
+            transplant(pRoot, nullptr);
+            pRoot->parent = nullptr;
+            if (root == nullptr) shared = false;
+            Node *current = pRoot, *parent;
+            bool owned;
+            while (current != nullptr) {
+                owned = current->refs.load(std::memory_order_acquire) == 1;
+                if (owned && current->left != nullptr)
+                    current = current->left;
+                else if (owned && current->right != nullptr)
+                    current = current->right;
+                else {
+                    parent = current->parent;
+                    if (parent != nullptr) {
+                        if (parent->left == current) parent->left = nullptr;
+                        else parent->right = nullptr;
+                    }
+                    if (owned) free_node(current);
+                    else release(current);
+                    current = parent;
+                }
             }
+        }
 
-            if (pRoot == root) {
-                delete root;
-                root = nullptr;
-                --size;
-            }
+        // immutable view of the current contents, taken in O(1). later writes copy
+        // only the nodes on the modified paths, everything else stays shared until
+        // the last snapshot is destroyed
+        Snapshot snapshot() {
+            evacuate_inline(); // shared nodes must not live inside this object
+            if (live_snapshots == nullptr) live_snapshots = std::make_shared<std::atomic<std::size_t>>(0);
+            live_snapshots->fetch_add(1, std::memory_order_relaxed);
+            shared = true;
+            finger = nullptr;
+            compacting = false;
+            if (root != nullptr) root->refs.fetch_add(1, std::memory_order_relaxed);
+            return Snapshot(root, size, live_snapshots);
         }
 
 };
 
-template <typename KeyType, typename ValueType>
-class TreeMap<KeyType, ValueType>::ConstIterator
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class TreeMap<KeyType, ValueType, InlineCapacity>::NodeHandle
+{
+    friend class TreeMap;
+private:
+  Node *node;
+
+  explicit NodeHandle(Node *node): node(node) {}
+public:
+  NodeHandle(): node(nullptr) {}
+  NodeHandle(const NodeHandle&) = delete;
+  NodeHandle& operator=(const NodeHandle&) = delete;
+
+  NodeHandle(NodeHandle&& other): node(other.node)
+  {
+    other.node = nullptr;
+  }
+
+  NodeHandle& operator=(NodeHandle&& other)
+  {
+    if (this != &other)
+    {
+        delete node;
+        node = other.node;
+        other.node = nullptr;
+    }
+    return *this;
+  }
+
+  ~NodeHandle()
+  {
+    delete node;
+  }
+
+  bool empty() const
+  {
+    return node == nullptr;
+  }
+
+  explicit operator bool() const
+  {
+    return node != nullptr;
+  }
+
+  const key_type& key() const
+  {
+    if (node == nullptr) throw std::out_of_range("empty node handle");
+    return node->node.first;
+  }
+
+  mapped_type& mapped() const
+  {
+    if (node == nullptr) throw std::out_of_range("empty node handle");
+    return node->node.second;
+  }
+};
+
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class TreeMap<KeyType, ValueType, InlineCapacity>::Snapshot
+{
+    friend class TreeMap;
+private:
+  class Version
+  {
+  public:
+    Node *root;
+    size_type size;
+    std::shared_ptr<std::atomic<std::size_t>> live; // the count of the map it was taken from
+
+    Version(Node *root, size_type size, std::shared_ptr<std::atomic<std::size_t>> live):
+      root(root), size(size), live(std::move(live)) {}
+    Version(const Version&) = delete;
+    Version& operator=(const Version&) = delete;
+
+    // the nodes are let go before the map may see the count drop and write to them in place
+    ~Version()
+    {
+      TreeMap::release(root);
+      if (live != nullptr) live->fetch_sub(1, std::memory_order_release);
+    }
+  };
+
+  std::shared_ptr<const Version> version;
+
+  Snapshot(Node *root, size_type size, std::shared_ptr<std::atomic<std::size_t>> live):
+    version(std::make_shared<const Version>(root, size, std::move(live))) {}
+public:
+  class ConstIterator;
+  using const_iterator = ConstIterator;
+
+  // snapshot nodes have no valid parent links, so iteration keeps its own path
+  class ConstIterator
+  {
+      friend class Snapshot;
+  public:
+    using reference = typename TreeMap::const_reference;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = typename TreeMap::value_type;
+    using pointer = const typename TreeMap::value_type*;
+  private:
+    std::vector<const Node*> path; // the current node on top, then ancestors still to be visited
+
+    void descend(const Node *node)
+    {
+      for (; node != nullptr; node = node->left)
+        path.push_back(node);
+    }
+  public:
+    ConstIterator() {}
+
+    ConstIterator& operator++()
+    {
+      if (path.empty()) throw std::out_of_range("cannot increment end iterator");
+      const Node *node = path.back();
+      path.pop_back();
+      descend(node->right);
+      return *this;
+    }
+
+    ConstIterator operator++(int)
+    {
+      ConstIterator it(*this);
+      operator++();
+      return it;
+    }
+
+    reference operator*() const
+    {
+      if (path.empty()) throw std::out_of_range("cannot dereference end iterator");
+      return path.back()->node;
+    }
+
+    pointer operator->() const
+    {
+      return &this->operator*();
+    }
+
+    bool operator==(const ConstIterator& other) const
+    {
+      if (path.empty() || other.path.empty()) return path.empty() && other.path.empty();
+      return path.back() == other.path.back();
+    }
+
+    bool operator!=(const ConstIterator& other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+  Snapshot() : Snapshot(nullptr, 0, nullptr) {}
+
+  bool isEmpty() const
+  {
+    return version->size == 0;
+  }
+
+  size_type getSize() const
+  {
+    return version->size;
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    ConstIterator it;
+    const Node *current = version->root;
+    while (current != nullptr && current->node.first != key)
+    {
+      if (key > current->node.first) current = current->right;
+      else
+      {
+        it.path.push_back(current);
+        current = current->left;
+      }
+    }
+    if (current == nullptr) return end();
+    it.path.push_back(current);
+    return it;
+  }
+
+  const mapped_type& valueOf(const key_type& key) const
+  {
+    const Node *current = version->root;
+    while (current != nullptr)
+    {
+      if (current->node.first == key) return current->node.second;
+      if (key > current->node.first) current = current->right;
+      else current = current->left;
+    }
+    throw std::out_of_range("such key doesn't exist");
+  }
+
+  const_iterator begin() const
+  {
+    ConstIterator it;
+    it.descend(version->root);
+    return it;
+  }
+
+  const_iterator end() const
+  {
+    return ConstIterator();
+  }
+
+  const_iterator cbegin() const
+  {
+    return begin();
+  }
+
+  const_iterator cend() const
+  {
+    return end();
+  }
+};
+
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class TreeMap<KeyType, ValueType, InlineCapacity>::ConstIterator
 {
     friend class TreeMap;
 public:
@@ -368,7 +1367,7 @@ public:
   using iterator_category = std::bidirectional_iterator_tag;
   using value_type = typename TreeMap::value_type;
   using pointer = const typename TreeMap::value_type*;
-private:
+protected:
     const TreeMap *tmap;
     Node *node;
 public:
@@ -461,8 +1460,8 @@ public:
       return (node != other.node);}
 };
 
-template <typename KeyType, typename ValueType>
-class TreeMap<KeyType, ValueType>::Iterator : public TreeMap<KeyType, ValueType>::ConstIterator
+template <typename KeyType, typename ValueType, std::size_t InlineCapacity>
+class TreeMap<KeyType, ValueType, InlineCapacity>::Iterator : public TreeMap<KeyType, ValueType, InlineCapacity>::ConstIterator
 {
 public:
   using reference = typename TreeMap::reference;
@@ -473,31 +1472,39 @@ public:
 
   Iterator(const ConstIterator& other)
     : ConstIterator(other)
-  {}
+  {
+    if (this->node != nullptr) this->node = owner()->own(this->node);
+  }
 
   Iterator& operator++()
   {
+    Node *from = this->node;
     ConstIterator::operator++();
+    // the next entry is either an ancestor, private already, or in the right subtree
+    if (from->right != nullptr) this->node = owner()->own(this->node, from);
     return *this;
   }
 
   Iterator operator++(int)
   {
     auto result = *this;
-    ConstIterator::operator++();
+    operator++();
     return result;
   }
 
   Iterator& operator--()
   {
+    Node *from = this->node;
     ConstIterator::operator--();
+    if (from == nullptr) this->node = owner()->own(this->node);
+    else if (from->left != nullptr) this->node = owner()->own(this->node, from);
     return *this;
   }
 
   Iterator operator--(int)
   {
     auto result = *this;
-    ConstIterator::operator--();
+    operator--();
     return result;
   }
 
@@ -511,6 +1518,13 @@ public:
     // ugly cast, yet reduces code duplication.
     return const_cast<reference>(ConstIterator::operator*());
   }
+
+private:
+  // mutable iterators only come from the non-const map
+  TreeMap* owner() const
+  {
+    return const_cast<TreeMap*>(this->tmap);
+  }
 };
 
 }
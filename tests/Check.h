@@ -0,0 +1,43 @@
+#ifndef AISDI_MAPS_TESTS_CHECK_H
+#define AISDI_MAPS_TESTS_CHECK_H
+
+#include <iostream>
+
+// checks for the standalone test programs, each of which is a single translation unit.
+// a failed check is reported with its place and counted, the program goes on
+#define CHECK(condition) ::aisdi::test::check((condition), #condition, __FILE__, __LINE__)
+
+namespace aisdi
+{
+namespace test
+{
+
+inline int& failures()
+{
+  static int count = 0;
+  return count;
+}
+
+inline bool check(bool passed, const char *what, const char *file, int line)
+{
+  if (passed) return true;
+  if (++failures() <= 20) std::cerr << file << ":" << line << ": check failed: " << what << "\n";
+  return false;
+}
+
+// exit status for main
+inline int report(const char *name)
+{
+  if (failures() == 0)
+  {
+    std::cout << name << ": ok\n";
+    return 0;
+  }
+  std::cerr << name << ": " << failures() << " checks failed\n";
+  return 1;
+}
+
+}
+}
+
+#endif /* AISDI_MAPS_TESTS_CHECK_H */
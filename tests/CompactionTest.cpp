@@ -0,0 +1,170 @@
+// compact() and shrink_to_fit() of HashMap and TreeMap: random churn against std::map with whole
+// compactions and budgeted ones carried on between writes, the nodes laid out one after another in
+// iteration order once a compaction finishes, even when writes and resizes came in between its
+// steps, the layout restored after more churn, and a tree shared with a snapshot left where it is
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "HashMap.h"
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+template <typename Map>
+bool holds(const Map& map, const std::map<int, int>& expected, bool ordered)
+{
+  if (map.getSize() != expected.size()) return false;
+  for (const auto& entry : expected)
+  {
+    auto it = map.find(entry.first);
+    if (it == map.end() || it->second != entry.second) return false;
+  }
+  std::size_t seen = 0;
+  auto wanted = expected.begin();
+  for (auto it = map.begin(); it != map.end(); ++it, ++wanted, seen++)
+    if (seen >= expected.size() || (ordered && it->first != wanted->first)) return false;
+  return seen == expected.size();
+}
+
+// entries visited in order lie at equal steps upwards in memory, leaving out the ones in the
+// inline storage, which compaction does not move
+template <typename Map>
+bool contiguous(Map& map)
+{
+  std::vector<std::uintptr_t> addresses;
+  std::uintptr_t first = reinterpret_cast<std::uintptr_t>(&map), last = first + sizeof(Map);
+  for (auto it = map.begin(); it != map.end(); ++it)
+  {
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(&it->second);
+    if (address < first || address >= last) addresses.push_back(address);
+  }
+  if (addresses.size() < 3) return true;
+  std::uintptr_t stride = addresses[1] - addresses[0];
+  if (addresses[1] <= addresses[0]) return false;
+  for (std::size_t i = 2; i < addresses.size(); i++)
+    if (addresses[i] <= addresses[i - 1] || addresses[i] - addresses[i - 1] != stride) return false;
+  return true;
+}
+
+template <typename Map>
+void test_churn_against_std_map(unsigned seed, bool ordered)
+{
+  std::mt19937 random(seed);
+  for (int round = 0; round < 8; round++)
+  {
+    Map map;
+    std::map<int, int> expected;
+    int keys = 100 + static_cast<int>(random() % 5000);
+    for (int step = 0; step < 10000; step++)
+    {
+      int key = static_cast<int>(random() % keys);
+      switch (random() % 100)
+      {
+      case 0:
+        CHECK(map.compact());
+        CHECK(holds(map, expected, ordered) && contiguous(map));
+        break;
+      case 1:
+        map.shrink_to_fit();
+        CHECK(holds(map, expected, ordered) && contiguous(map));
+        break;
+      case 2: case 3: case 4: case 5:
+        // a tiny budget stops the compaction early, writes come in before it carries on
+        map.compact(std::chrono::nanoseconds(1));
+        break;
+      default:
+        if (random() % 3 == 0)
+        {
+          if (expected.erase(key) != 0) map.remove(key);
+        }
+        else
+        {
+          map[key] = step;
+          expected[key] = step;
+        }
+      }
+    }
+    CHECK(holds(map, expected, ordered));
+    while (!map.compact(std::chrono::nanoseconds(1)))
+    {
+    }
+    CHECK(holds(map, expected, ordered) && contiguous(map));
+
+    // copies and moves of a compacted map hold the same entries
+    Map copy(map);
+    Map moved(std::move(map));
+    CHECK(holds(copy, expected, ordered) && holds(moved, expected, ordered));
+  }
+}
+
+// removing most of a map and compacting brings the survivors together again
+template <typename Map>
+void test_layout_restored(bool ordered)
+{
+  Map map;
+  std::map<int, int> expected;
+  std::mt19937 random(38);
+  for (int i = 0; i < 50000; i++)
+  {
+    int key = static_cast<int>(random());
+    map[key] = i;
+    expected[key] = i;
+  }
+  for (auto it = expected.begin(); it != expected.end();)
+  {
+    if (random() % 10 != 0)
+    {
+      map.remove(it->first);
+      it = expected.erase(it);
+    }
+    else ++it;
+  }
+  CHECK(map.compact());
+  CHECK(holds(map, expected, ordered) && contiguous(map));
+  CHECK(map.compact()); // nothing left to do
+  CHECK(contiguous(map));
+  for (int i = 0; i < 1000; i++)
+  {
+    map[-i - 1] = i;
+    expected[-i - 1] = i;
+  }
+  map.shrink_to_fit();
+  CHECK(holds(map, expected, ordered) && contiguous(map));
+}
+
+// a tree shared with a snapshot is not compacted, the snapshot keeps its nodes
+void test_tree_with_snapshot()
+{
+  TreeMap<int, int> map;
+  std::map<int, int> expected;
+  for (int key = 0; key < 1000; key++) map[(key * 7919) % 1000] = expected[(key * 7919) % 1000] = key;
+  auto snapshot = map.snapshot();
+  const int *address = &snapshot.valueOf(500);
+  CHECK(map.compact());
+  CHECK(&snapshot.valueOf(500) == address && holds(map, expected, true));
+  map[5000] = 1;
+  CHECK(snapshot.getSize() == 1000 && map.getSize() == 1001);
+}
+
+}
+
+int main()
+{
+  test_churn_against_std_map<HashMap<int, int>>(38, false);
+  test_churn_against_std_map<HashMap<int, int, 4>>(39, false);
+  test_churn_against_std_map<TreeMap<int, int>>(40, true);
+  test_churn_against_std_map<TreeMap<int, int, 4>>(41, true);
+  test_layout_restored<HashMap<int, int>>(false);
+  test_layout_restored<TreeMap<int, int>>(true);
+  test_tree_with_snapshot();
+  return test::report("CompactionTest");
+}
@@ -0,0 +1,239 @@
+// ConcurrentSkipListMap: one thread against std::map, then writers and readers at once. writers
+// on disjoint keys leave a state known exactly, writers on a few shared keys are checked through
+// the results they report, and readers check what they see: scans in order with whole entries,
+// and no value coming back after the key was seen without it, since every value is written once.
+// meant to be run under the thread and address sanitizers too
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ConcurrentSkipListMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+using Map = ConcurrentSkipListMap<long, long>;
+
+void test_single_thread_against_std_map()
+{
+  std::mt19937 random(40);
+  Map map;
+  std::map<long, long> expected;
+  for (int step = 0; step < 20000; step++)
+  {
+    long key = static_cast<long>(random() % 500);
+    switch (random() % 6)
+    {
+    case 0:
+      CHECK(map.upsert(key, step) == (expected.count(key) == 0));
+      expected[key] = step;
+      break;
+    case 1:
+      CHECK(map.insert(key, step) == expected.insert(std::make_pair(key, step)).second);
+      break;
+    case 2:
+      CHECK(map.erase(key) == (expected.erase(key) != 0));
+      break;
+    case 3:
+    {
+      CHECK(map.contains(key) == (expected.count(key) != 0));
+      if (expected.count(key) != 0) CHECK(map.valueOf(key) == expected[key]);
+      auto lower = map.lower_bound(key);
+      auto expected_lower = expected.lower_bound(key);
+      CHECK(lower == map.end() ? expected_lower == expected.end() : expected_lower != expected.end() && lower->first == expected_lower->first);
+      auto upper = map.upper_bound(key);
+      auto expected_upper = expected.upper_bound(key);
+      CHECK(upper == map.end() ? expected_upper == expected.end() : expected_upper != expected.end() && upper->first == expected_upper->first);
+      break;
+    }
+    case 4:
+    {
+      std::vector<long> seen, wanted;
+      map.for_each_in_range(key, key + 50, [&](const Map::value_type& entry) { seen.push_back(entry.first); });
+      for (auto it = expected.lower_bound(key); it != expected.lower_bound(key + 50); ++it) wanted.push_back(it->first);
+      CHECK(seen == wanted);
+      break;
+    }
+    default:
+      if (expected.count(key) != 0)
+      {
+        map.remove(key);
+        expected.erase(key);
+      }
+      else
+      {
+        bool thrown = false;
+        try
+        {
+          map.remove(key);
+        }
+        catch (const std::out_of_range&)
+        {
+          thrown = true;
+        }
+        CHECK(thrown);
+      }
+    }
+  }
+  CHECK(map.getSize() == expected.size());
+  auto it = map.begin();
+  for (const auto& entry : expected)
+  {
+    CHECK(it != map.end() && it->first == entry.first && it->second == entry.second);
+    if (it != map.end()) ++it;
+  }
+  CHECK(it == map.end());
+}
+
+// a full scan sees keys in increasing order and values made for their keys
+bool scan_is_consistent(const Map& map)
+{
+  long previous = -1;
+  for (auto it = map.begin(); it != map.end(); ++it)
+  {
+    if (it->first <= previous || it->second % 1024 != it->first % 1024) return false;
+    previous = it->first;
+  }
+  return true;
+}
+
+// every writer owns the keys equal to its number modulo the writer count and leaves the even slots
+void test_disjoint_writers()
+{
+  const int writers = 4, slots = 2000;
+  Map map;
+  std::atomic<bool> stop(false), failed(false);
+  std::vector<std::thread> threads;
+  for (int writer = 0; writer < writers; writer++)
+    threads.emplace_back([&map, writer]
+    {
+      std::mt19937 random(writer);
+      for (int step = 0; step < 20000; step++)
+      {
+        long key = static_cast<long>(random() % slots) * writers + writer;
+        switch (random() % 4)
+        {
+        case 0: case 1: map.upsert(key, key + 1024 * step); break;
+        case 2: map.insert(key, key); break;
+        default: map.erase(key);
+        }
+      }
+      for (long slot = 0; slot < slots; slot++)
+      {
+        long key = slot * writers + writer;
+        if (slot % 2 == 0) map.upsert(key, key);
+        else map.erase(key);
+      }
+    });
+  std::thread scanner([&]
+  {
+    while (!stop)
+      if (!scan_is_consistent(map)) failed = true;
+  });
+  std::thread ranger([&]
+  {
+    while (!stop)
+    {
+      long previous = 99;
+      map.for_each_in_range(100, 3000, [&](const Map::value_type& entry)
+      {
+        if (entry.first <= previous || entry.first >= 3000 || entry.second % 1024 != entry.first % 1024) failed = true;
+        previous = entry.first;
+      });
+    }
+  });
+  for (auto& thread : threads) thread.join();
+  stop = true;
+  scanner.join();
+  ranger.join();
+  CHECK(!failed);
+  std::size_t seen = 0;
+  for (auto it = map.begin(); it != map.end(); ++it, seen++)
+    CHECK((it->first / writers) % 2 == 0 && it->second == it->first);
+  CHECK(seen == static_cast<std::size_t>(writers * slots / 2));
+  CHECK(map.getSize() == seen);
+}
+
+// writers fight over a few keys. what they report adds up: per key, additions minus removals is
+// whether the key is there at the end. readers never see a value again once they saw it replaced
+// or removed, as each value is written once
+void test_contended_keys()
+{
+  const int writers = 4, readers = 2, keys = 8, steps = 30000;
+  Map map;
+  std::atomic<long> serial(1);
+  std::atomic<bool> stop(false), failed(false);
+  std::vector<std::atomic<long>> balance(keys);
+  for (auto& count : balance) count = 0;
+  std::vector<std::thread> threads;
+  for (int writer = 0; writer < writers; writer++)
+    threads.emplace_back([&, writer]
+    {
+      std::mt19937 random(writer + 100);
+      for (int step = 0; step < steps; step++)
+      {
+        long key = static_cast<long>(random() % keys);
+        long value = serial.fetch_add(1) * 1024 + key;
+        switch (random() % 3)
+        {
+        case 0: if (map.upsert(key, value)) balance[key]++; break;
+        case 1: if (map.insert(key, value)) balance[key]++; break;
+        default: if (map.erase(key)) balance[key]--;
+        }
+      }
+    });
+  for (int reader = 0; reader < readers; reader++)
+    threads.emplace_back([&]
+    {
+      std::vector<long> last(keys, 0); // value seen last, 0 for none
+      std::vector<std::vector<long>> gone(keys); // values seen before the last one
+      while (!stop)
+        for (long key = 0; key < keys; key++)
+        {
+          long value = 0;
+          try
+          {
+            value = map.valueOf(key);
+          }
+          catch (const std::out_of_range&)
+          {
+          }
+          if (value == last[key]) continue;
+          for (long old : gone[key])
+            if (old == value) failed = true;
+          if (last[key] != 0) gone[key].push_back(last[key]);
+          if (gone[key].size() > 64) gone[key].erase(gone[key].begin());
+          last[key] = value;
+        }
+    });
+  for (int writer = 0; writer < writers; writer++) threads[writer].join();
+  stop = true;
+  for (std::size_t thread = writers; thread < threads.size(); thread++) threads[thread].join();
+  CHECK(!failed);
+  std::size_t present = 0;
+  for (long key = 0; key < keys; key++)
+  {
+    CHECK(balance[key] == (map.contains(key) ? 1 : 0));
+    if (map.contains(key)) present++;
+  }
+  CHECK(map.getSize() == present);
+  CHECK(scan_is_consistent(map));
+}
+
+}
+
+int main()
+{
+  test_single_thread_against_std_map();
+  test_disjoint_writers();
+  test_contended_keys();
+  return test::report("ConcurrentSkipListMapTest");
+}
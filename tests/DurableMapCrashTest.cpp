@@ -0,0 +1,275 @@
+// crash injection for DurableMap. a child process applies a fixed sequence of changes and kills
+// itself with SIGKILL the n-th time it reaches a DurabilityPoint. the parent then reopens the
+// directory and checks that what was recovered is the state after some prefix of the sequence,
+// one that includes every change flush() had confirmed, and that the recovered map takes further
+// changes. a half written record is appended to the newest log first, as a crash in the middle of
+// a write would leave it.
+//
+//   g++ -std=c++14 -pthread -I.. DurableMapCrashTest.cpp -o DurableMapCrashTest && ./DurableMapCrashTest
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "DurableMap.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+struct Change
+{
+  int key;
+  std::string value;
+  bool put; // otherwise a remove
+};
+
+const int change_count = 4000;
+const int confirm_every = 100; // the child flushes and reports after this many changes
+
+std::vector<Change> make_changes()
+{
+  std::mt19937 random(2024);
+  std::vector<Change> changes;
+  std::map<int, bool> present;
+  for (int i = 0; i < change_count; i++)
+  {
+    int key = static_cast<int>(random() % 300);
+    bool put = !present[key] || random() % 4 != 0;
+    present[key] = put;
+    changes.push_back(Change{key, std::string(random() % 40, static_cast<char>('a' + i % 26)) + std::to_string(i), put});
+  }
+  return changes;
+}
+
+DurabilityPoint crash_at;
+std::atomic<int> countdown;
+
+void crash(DurabilityPoint point)
+{
+  if (point == crash_at && countdown.fetch_sub(1) == 1) ::kill(::getpid(), SIGKILL);
+}
+
+DurabilityOptions options_for_test(bool with_crash)
+{
+  DurabilityOptions options;
+  options.commit_interval = std::chrono::milliseconds(1);
+  options.checkpoint_bytes = 16 << 10; // a checkpoint every few hundred changes
+  options.sync = false; // a killed process loses nothing it wrote, only a power cut needs the syncs
+  if (with_crash) options.crash_point = crash;
+  return options;
+}
+
+std::string make_directory()
+{
+  char name[] = "/tmp/durable-crash-XXXXXX";
+  if (::mkdtemp(name) == nullptr) throw std::runtime_error("cannot create a temporary directory");
+  return name;
+}
+
+void remove_directory(const std::string& directory)
+{
+  std::string command = "rm -rf '" + directory + "'";
+  if (std::system(command.c_str()) != 0) std::cerr << "cannot remove " << directory << "\n";
+}
+
+// what a crash in the middle of a write leaves at the end of a log
+void tear_newest_log(const std::string& directory)
+{
+  std::uint64_t newest = 0;
+  bool found = false;
+  for (std::uint64_t generation = 0; generation < 1000; generation++)
+    if (::access((directory + "/wal." + std::to_string(generation)).c_str(), F_OK) == 0)
+    {
+      newest = generation;
+      found = true;
+    }
+  if (!found) return;
+  int fd = ::open((directory + "/wal." + std::to_string(newest)).c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0) return;
+  const char torn[] = "\x20\x00\x00\x00\x11";
+  detail::write_all(fd, torn, sizeof(torn) - 1, "log");
+  ::close(fd);
+}
+
+// the child: applies the changes, reports each confirmed count through the pipe, crashes on the way
+template <template <typename, typename, std::size_t> class MapType>
+void run_child(const std::string& directory, const std::vector<Change>& changes, int report)
+{
+  DurableMap<int, std::string, MapType> map(directory, options_for_test(true));
+  for (int i = 0; i < change_count; i++)
+  {
+    if (changes[i].put) map.put(changes[i].key, changes[i].value);
+    else map.remove(changes[i].key);
+    if ((i + 1) % confirm_every == 0)
+    {
+      map.flush();
+      int confirmed = i + 1;
+      if (::write(report, &confirmed, sizeof(confirmed)) != sizeof(confirmed)) ::_exit(2);
+    }
+  }
+}
+
+template <typename Map>
+bool same(const Map& map, const std::map<int, std::string>& expected)
+{
+  if (map.getSize() != expected.size()) return false;
+  for (const auto& entry : expected)
+  {
+    auto it = map.find(entry.first);
+    if (it == map.end() || it->second != entry.second) return false;
+  }
+  return true;
+}
+
+// length of the shortest prefix of the changes, at least confirmed long, whose state map holds. -1 if none
+template <typename Map>
+int recovered_prefix(const Map& map, const std::vector<Change>& changes, int confirmed)
+{
+  std::map<int, std::string> expected;
+  for (int i = 0; i <= change_count; i++)
+  {
+    if (i >= confirmed && same(map, expected)) return i;
+    if (i == change_count) break;
+    if (changes[i].put) expected[changes[i].key] = changes[i].value;
+    else expected.erase(changes[i].key);
+  }
+  return -1;
+}
+
+// runs one crash and checks the recovery, returns false on a failure. crashed tells whether the point was reached
+template <template <typename, typename, std::size_t> class MapType>
+bool crash_and_recover(const std::vector<Change>& changes, DurabilityPoint point, int hit, bool& crashed)
+{
+  std::string directory = make_directory();
+  int pipe_ends[2];
+  if (::pipe(pipe_ends) != 0) throw std::runtime_error("cannot create a pipe");
+  crash_at = point;
+  countdown = hit;
+  pid_t child = ::fork();
+  if (child < 0) throw std::runtime_error("cannot fork");
+  if (child == 0)
+  {
+    ::close(pipe_ends[0]);
+    try
+    {
+      run_child<MapType>(directory, changes, pipe_ends[1]);
+    }
+    catch (const std::exception& e)
+    {
+      std::cerr << "child failed: " << e.what() << "\n";
+      ::_exit(1);
+    }
+    ::_exit(0);
+  }
+  ::close(pipe_ends[1]);
+  int confirmed = 0, reported;
+  while (::read(pipe_ends[0], &reported, sizeof(reported)) == sizeof(reported)) confirmed = reported;
+  ::close(pipe_ends[0]);
+  int status;
+  ::waitpid(child, &status, 0);
+  crashed = WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+  bool passed = true;
+  if (!crashed && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+  {
+    std::cerr << "child ended abnormally\n";
+    passed = false;
+  }
+
+  tear_newest_log(directory);
+  try
+  {
+    std::map<int, std::string> recovered;
+    {
+      DurableMap<int, std::string, MapType> map(directory, options_for_test(false));
+      if (recovered_prefix(map, changes, confirmed) < 0)
+      {
+        std::cerr << "recovered " << map.getSize() << " entries, not the state after any prefix from "
+                  << confirmed << " confirmed changes on\n";
+        passed = false;
+      }
+      for (auto it = map.begin(); it != map.end(); ++it) recovered[it->first] = it->second;
+      map.put(-1, "after recovery");
+    }
+    recovered[-1] = "after recovery";
+    DurableMap<int, std::string, MapType> reopened(directory, options_for_test(false));
+    if (!same(reopened, recovered))
+    {
+      std::cerr << "a change made after recovery was lost\n";
+      passed = false;
+    }
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "recovery failed: " << e.what() << "\n";
+    passed = false;
+  }
+  remove_directory(directory);
+  return passed;
+}
+
+const char* name_of(DurabilityPoint point)
+{
+  switch (point)
+  {
+    case DurabilityPoint::record_queued: return "record_queued";
+    case DurabilityPoint::log_written: return "log_written";
+    case DurabilityPoint::checkpoint_written: return "checkpoint_written";
+    case DurabilityPoint::checkpoint_renamed: return "checkpoint_renamed";
+  }
+  return "?";
+}
+
+template <template <typename, typename, std::size_t> class MapType>
+int run_all(const char *map_name, const std::vector<Change>& changes)
+{
+  const DurabilityPoint points[] = {DurabilityPoint::record_queued, DurabilityPoint::log_written,
+                                    DurabilityPoint::checkpoint_written, DurabilityPoint::checkpoint_renamed};
+  const int hits[] = {1, 2, 3, 5, 8, 13, 40, 150, 1000, 3999};
+  int failures = 0;
+  for (DurabilityPoint point : points)
+  {
+    int crashes = 0;
+    for (int hit : hits)
+    {
+      bool crashed;
+      if (!crash_and_recover<MapType>(changes, point, hit, crashed))
+      {
+        std::cerr << map_name << ": crash at " << name_of(point) << " #" << hit << " failed\n";
+        failures++;
+      }
+      if (crashed) crashes++;
+    }
+    if (crashes == 0)
+    {
+      std::cerr << map_name << ": " << name_of(point) << " was never reached\n";
+      failures++;
+    }
+  }
+  return failures;
+}
+
+}
+
+int main()
+{
+  std::vector<Change> changes = make_changes();
+  int failures = run_all<aisdi::HashMap>("HashMap", changes) + run_all<aisdi::TreeMap>("TreeMap", changes);
+  if (failures != 0)
+  {
+    std::cerr << failures << " failures\n";
+    return 1;
+  }
+  std::cout << "all crashes recovered\n";
+  return 0;
+}
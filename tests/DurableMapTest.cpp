@@ -0,0 +1,187 @@
+// DurableMap without crashes: random changes with checkpoints of both kinds in between, the
+// snapshot of a TreeMap and the rebuild from the files for a HashMap, reopened and compared with
+// std::map after every round, old logs dropped, and a HashMap checkpoint copying no value
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "DurableMap.h"
+#include "Check.h"
+
+namespace
+{
+
+// counts copies, which is what freezing a map by copying it costs
+struct Counted
+{
+  static std::size_t copies;
+  long value;
+
+  Counted(): value(0) {}
+  Counted(long value): value(value) {}
+  Counted(const Counted& other): value(other.value) { copies++; }
+  Counted(Counted&& other): value(other.value) {}
+  Counted& operator=(const Counted& other)
+  {
+    value = other.value;
+    copies++;
+    return *this;
+  }
+  Counted& operator=(Counted&& other) = default;
+};
+
+std::size_t Counted::copies = 0;
+
+}
+
+namespace aisdi
+{
+
+template <>
+struct Serializer<Counted>
+{
+  static void write(std::string& out, const Counted& counted)
+  {
+    Serializer<long>::write(out, counted.value);
+  }
+
+  static bool read(const char*& data, const char *end, Counted& counted)
+  {
+    return Serializer<long>::read(data, end, counted.value);
+  }
+};
+
+}
+
+using namespace aisdi;
+
+namespace
+{
+
+std::string make_directory()
+{
+  char name[] = "/tmp/durable-test-XXXXXX";
+  if (::mkdtemp(name) == nullptr) throw std::runtime_error("cannot create a temporary directory");
+  return name;
+}
+
+void remove_directory(const std::string& directory)
+{
+  std::string command = "rm -rf '" + directory + "'";
+  if (std::system(command.c_str()) != 0) std::cerr << "cannot remove " << directory << "\n";
+}
+
+std::size_t count_logs(const std::string& directory)
+{
+  std::size_t logs = 0;
+  DIR *listing = ::opendir(directory.c_str());
+  if (listing == nullptr) return 0;
+  while (dirent *entry = ::readdir(listing))
+    if (std::string(entry->d_name).compare(0, 4, "wal.") == 0) logs++;
+  ::closedir(listing);
+  return logs;
+}
+
+template <typename Map>
+bool holds(const Map& map, const std::map<int, std::string>& expected)
+{
+  if (map.getSize() != expected.size()) return false;
+  for (const auto& entry : expected)
+  {
+    auto it = map.find(entry.first);
+    if (it == map.end() || it->second != entry.second) return false;
+  }
+  return true;
+}
+
+DurabilityOptions fast_options(std::size_t checkpoint_bytes)
+{
+  DurabilityOptions options;
+  options.commit_interval = std::chrono::milliseconds(1);
+  options.checkpoint_bytes = checkpoint_bytes;
+  options.sync = false;
+  return options;
+}
+
+template <template <typename, typename, std::size_t> class MapType>
+void test_random_rounds(unsigned seed)
+{
+  std::string directory = make_directory();
+  std::map<int, std::string> expected;
+  std::mt19937 random(seed);
+  for (int round = 0; round < 12; round++)
+  {
+    DurableMap<int, std::string, MapType> map(directory, fast_options(round % 2 == 0 ? 4096 : std::size_t(1) << 30));
+    CHECK(holds(map, expected));
+    for (int step = 0; step < 1500; step++)
+    {
+      int key = static_cast<int>(random() % 400);
+      switch (random() % 10)
+      {
+      case 0: case 1: case 2:
+        if (expected.count(key) != 0)
+        {
+          map.remove(key);
+          expected.erase(key);
+        }
+        break;
+      case 3:
+        if (random() % 50 == 0) map.checkpoint();
+        break;
+      default:
+      {
+        std::string value(random() % 30, static_cast<char>('a' + round));
+        value += std::to_string(step);
+        map.put(key, value);
+        expected[key] = value;
+      }
+      }
+    }
+    if (round % 3 == 0)
+    {
+      map.checkpoint();
+      CHECK(count_logs(directory) <= 1);
+    }
+    else map.flush();
+    CHECK(holds(map, expected));
+  }
+  DurableMap<int, std::string, MapType> reopened(directory, fast_options(std::size_t(1) << 30));
+  CHECK(holds(reopened, expected));
+  remove_directory(directory);
+}
+
+// a checkpoint of a HashMap leaves the map alone, nothing in it is copied
+void test_hash_checkpoint_copies_nothing()
+{
+  std::string directory = make_directory();
+  {
+    DurableMap<int, Counted, HashMap> map(directory, fast_options(std::size_t(1) << 30));
+    for (int key = 0; key < 5000; key++) map.put(key, Counted(key));
+    map.checkpoint();
+    for (int key = 0; key < 5000; key += 2) map.remove(key);
+    Counted::copies = 0;
+    map.checkpoint();
+    map.put(-1, Counted(-1));
+    map.checkpoint();
+    CHECK(Counted::copies == 0);
+  }
+  DurableMap<int, Counted, HashMap> reopened(directory, fast_options(std::size_t(1) << 30));
+  CHECK(reopened.getSize() == 2501);
+  CHECK(reopened.valueOf(-1).value == -1 && reopened.valueOf(4999).value == 4999 && !reopened.contains(4998));
+  remove_directory(directory);
+}
+
+}
+
+int main()
+{
+  test_random_rounds<HashMap>(41);
+  test_random_rounds<TreeMap>(42);
+  test_hash_checkpoint_copies_nothing();
+  return test::report("DurableMapTest");
+}
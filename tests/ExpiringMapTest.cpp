@@ -0,0 +1,204 @@
+// ExpiringMap against a std::map holding what the map should still store: puts, refreshes, reads
+// and removals with time to live from a tick to past the reach of the wheel, the clock moved in
+// small and large steps from several starting points, and advance() reclaiming exactly the
+// entries that expired, over HashMap and TreeMap. entries refreshed again and again keep one timer
+// each, so reclaiming them takes about as many lookups as reclaiming entries written once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "ExpiringMap.h"
+#include "TreeMap.h"
+#include "Check.h"
+
+namespace
+{
+
+std::size_t hash_calls = 0;
+
+struct Key
+{
+  int value;
+
+  bool operator==(const Key& other) const
+  {
+    return value == other.value;
+  }
+
+  bool operator!=(const Key& other) const
+  {
+    return value != other.value;
+  }
+};
+
+}
+
+namespace std
+{
+
+template <>
+struct hash<Key>
+{
+  std::size_t operator()(const Key& key) const
+  {
+    hash_calls++;
+    return std::hash<int>()(key.value);
+  }
+};
+
+}
+
+using namespace aisdi;
+
+namespace
+{
+
+using tick_type = std::uint64_t;
+
+template <template <typename, typename, std::size_t> class MapType>
+void test_against_model(unsigned seed, tick_type start)
+{
+  ExpiringMap<int, int, MapType> map(start);
+  std::map<int, std::pair<int, tick_type>> stored; // value and expiry of every entry not reclaimed yet
+  std::mt19937_64 random(seed);
+  tick_type now = start;
+  auto live = [&](int key) { auto it = stored.find(key); return it != stored.end() && it->second.second > now; };
+  for (int step = 0; step < 100000; step++)
+  {
+    int key = static_cast<int>(random() % 1000);
+    tick_type ttl;
+    switch (random() % 4)
+    {
+    case 0: ttl = random() % 5; break;
+    case 1: ttl = random() % 300; break;
+    case 2: ttl = random() % 100000; break;
+    default: ttl = random() % 40000000; // further than the wheel reaches
+    }
+    switch (random() % 20)
+    {
+    case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
+      map.put(key, step, ttl);
+      if (ttl == 0) stored.erase(key);
+      else stored[key] = std::make_pair(step, now + ttl);
+      break;
+    case 8:
+    {
+      bool refreshed = live(key);
+      CHECK(map.refresh(key, ttl) == refreshed);
+      if (refreshed && ttl == 0) stored.erase(key);
+      else if (refreshed) stored[key].second = now + ttl;
+      break;
+    }
+    case 9: case 10: case 11: case 12: case 13: case 14:
+    {
+      bool present = live(key);
+      CHECK(map.contains(key) == present);
+      if (present) CHECK(map.valueOf(key) == stored[key].first && map.ttl(key) == stored[key].second - now);
+      int *value = map.get(key);
+      CHECK((value != nullptr) == present);
+      if (present) CHECK(*value == stored[key].first);
+      else stored.erase(key); // get drops an expired entry
+      break;
+    }
+    case 15:
+      if (live(key))
+      {
+        map.remove(key);
+        stored.erase(key);
+      }
+      else
+      {
+        bool thrown = false;
+        try
+        {
+          map.remove(key);
+        }
+        catch (const std::out_of_range&)
+        {
+          thrown = true;
+        }
+        CHECK(thrown);
+      }
+      break;
+    default:
+    {
+      now += random() % 3 == 0 ? random() % 1000000 : random() % 100;
+      std::size_t expired = 0;
+      for (auto it = stored.begin(); it != stored.end();)
+      {
+        if (it->second.second <= now)
+        {
+          it = stored.erase(it);
+          expired++;
+        }
+        else ++it;
+      }
+      CHECK(map.advance(now) == expired);
+      CHECK(map.now() == now && map.getSize() == stored.size());
+    }
+    }
+  }
+  now += 100000000;
+  CHECK(map.advance(now) == stored.size());
+  CHECK(map.isEmpty());
+}
+
+// one entry refreshed many times to later and earlier expiries leaves once, at the last expiry
+void test_refreshed_entry_expires_once()
+{
+  ExpiringMap<int, int> map;
+  map.put(1, 1, 10);
+  for (tick_type tick = 1; tick <= 5000; tick++)
+  {
+    CHECK(map.advance(tick) == 0);
+    CHECK(map.refresh(1, tick % 7 == 0 ? 3 : 50));
+  }
+  CHECK(map.ttl(1) == 50 && map.getSize() == 1);
+  CHECK(map.advance(5049) == 0 && map.contains(1));
+  CHECK(map.advance(5050) == 1 && !map.contains(1) && map.isEmpty());
+  CHECK(!map.refresh(1, 10));
+}
+
+// lookups made while reclaiming every entry, each firing timer looks its key up once
+std::size_t reclaim_lookups(ExpiringMap<Key, int>& map, tick_type until)
+{
+  std::size_t expired = 0;
+  hash_calls = 0;
+  for (tick_type tick = 1; tick <= until; tick++) expired += map.advance(tick);
+  CHECK(expired == 20000 && map.isEmpty());
+  return hash_calls;
+}
+
+// refreshing every entry fifty times before it expires leaves the wheel about as small as writing
+// each once: the timers of later expiries are not filed, the first one files itself again
+void test_refreshes_keep_one_timer()
+{
+  ExpiringMap<Key, int> written, refreshed;
+  for (int key = 0; key < 20000; key++)
+  {
+    written.put(Key{key}, key, 1000 + key % 1000);
+    refreshed.put(Key{key}, key, 1);
+  }
+  for (int round = 1; round <= 50; round++)
+    for (int key = 0; key < 20000; key++) refreshed.refresh(Key{key}, round == 50 ? 1000 + key % 1000 : 10 * round);
+  std::size_t once = reclaim_lookups(written, 2000), many = reclaim_lookups(refreshed, 2000);
+  CHECK(once == 20000 && many <= 2 * once);
+}
+
+}
+
+int main()
+{
+  test_against_model<HashMap>(35, 0);
+  test_against_model<TreeMap>(36, 0);
+  test_against_model<HashMap>(37, 12345678901ull);
+  test_against_model<TreeMap>(38, (tick_type(1) << 24) - 7);
+  test_refreshed_entry_expires_once();
+  test_refreshes_keep_one_timer();
+  return test::report("ExpiringMapTest");
+}
@@ -0,0 +1,168 @@
+// frozen maps against std::map: maps of many sizes frozen with freeze(), every key found with its
+// value and no other key found, bounds and iteration both ways on the Eytzinger tree, keys whose
+// hashes are equal in small groups or all alike, and frozen copies left alone by later writes
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "FrozenMap.h"
+#include "Check.h"
+
+namespace
+{
+
+// keys hashed in groups of three, or all to one value when shared is set
+struct Key
+{
+  int value;
+  bool shared;
+
+  bool operator==(const Key& other) const
+  {
+    return value == other.value;
+  }
+
+  bool operator!=(const Key& other) const
+  {
+    return value != other.value;
+  }
+};
+
+}
+
+namespace std
+{
+
+template <>
+struct hash<Key>
+{
+  std::size_t operator()(const Key& key) const
+  {
+    return key.shared ? 7 : static_cast<std::size_t>(key.value / 3);
+  }
+};
+
+}
+
+using namespace aisdi;
+
+namespace
+{
+
+template <typename Frozen>
+bool throws_on(const Frozen& frozen, const typename Frozen::key_type& key)
+{
+  try
+  {
+    frozen.valueOf(key);
+  }
+  catch (const std::out_of_range&)
+  {
+    return true;
+  }
+  return false;
+}
+
+void test_against_std_map()
+{
+  std::mt19937 random(32);
+  for (int size : {0, 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 33, 100, 1000, 12345, 100000})
+  {
+    HashMap<int, std::string> hash_map;
+    TreeMap<int, std::string> tree_map;
+    std::map<int, std::string> expected;
+    for (int i = 0; i < size; i++)
+    {
+      int key = static_cast<int>(random() % (3 * size + 1)) - size;
+      hash_map[key] = tree_map[key] = expected[key] = std::to_string(i);
+    }
+    auto frozen_hash = freeze(hash_map);
+    auto frozen_tree = freeze(tree_map);
+    CHECK(frozen_hash.getSize() == expected.size() && frozen_tree.getSize() == expected.size());
+    CHECK(frozen_hash.isEmpty() == expected.empty() && frozen_tree.isEmpty() == expected.empty());
+    for (const auto& entry : expected)
+      CHECK(frozen_hash.valueOf(entry.first) == entry.second && frozen_tree.valueOf(entry.first) == entry.second);
+
+    int step = size > 1000 ? 37 : 1;
+    for (int key = -size - 5; key < 2 * size + 5; key += step)
+    {
+      bool present = expected.count(key) != 0;
+      CHECK((frozen_hash.find(key) != frozen_hash.end()) == present);
+      CHECK((frozen_tree.find(key) != frozen_tree.end()) == present);
+      if (!present) CHECK(throws_on(frozen_hash, key) && throws_on(frozen_tree, key));
+      auto lower = frozen_tree.lower_bound(key);
+      auto expected_lower = expected.lower_bound(key);
+      CHECK(lower == frozen_tree.end() ? expected_lower == expected.end() : expected_lower != expected.end() && lower->first == expected_lower->first);
+    }
+
+    auto wanted = expected.begin();
+    for (auto it = frozen_tree.begin(); it != frozen_tree.end(); ++it, ++wanted)
+      CHECK(wanted != expected.end() && it->first == wanted->first && it->second == wanted->second);
+    CHECK(wanted == expected.end());
+    auto back = expected.rbegin();
+    for (auto it = frozen_tree.end(); it != frozen_tree.begin(); ++back)
+    {
+      --it;
+      CHECK(back != expected.rend() && it->first == back->first);
+    }
+    std::map<int, std::string> seen;
+    for (auto it = frozen_hash.begin(); it != frozen_hash.end(); ++it) seen.insert(*it);
+    CHECK(seen == expected);
+  }
+}
+
+// keys sharing hash values cannot be told apart by the perfect hash and are kept aside
+void test_equal_hashes()
+{
+  for (int size : {1, 2, 3, 4, 10, 1000, 30000})
+  {
+    HashMap<Key, int> map;
+    for (int i = 0; i < size; i++) map[Key{i, false}] = 2 * i;
+    auto frozen = freeze(map);
+    CHECK(frozen.getSize() == static_cast<std::size_t>(size));
+    for (int i = 0; i < size; i++) CHECK(frozen.valueOf(Key{i, false}) == 2 * i);
+    for (int i = size; i < size + 50; i++) CHECK(frozen.find(Key{i, false}) == frozen.end());
+    std::size_t seen = 0;
+    for (auto it = frozen.begin(); it != frozen.end(); ++it, seen++) CHECK(it->second == 2 * it->first.value);
+    CHECK(seen == static_cast<std::size_t>(size));
+  }
+
+  HashMap<Key, int> alike;
+  for (int i = 0; i < 500; i++) alike[Key{i, true}] = i;
+  alike[Key{-1, false}] = -1;
+  auto frozen = freeze(alike);
+  CHECK(frozen.getSize() == 501);
+  for (int i = -1; i < 500; i++) CHECK(frozen.valueOf(Key{i, i >= 0}) == i);
+  CHECK(frozen.find(Key{500, true}) == frozen.end() && frozen.find(Key{-2, false}) == frozen.end());
+}
+
+// a frozen map is a copy, writes to the source or its destruction do not reach it
+void test_frozen_copy_is_independent()
+{
+  HashMap<std::string, int, 4> hash_map;
+  TreeMap<std::string, int, 4> tree_map;
+  for (int i = 0; i < 10; i++) hash_map[std::to_string(i)] = tree_map[std::to_string(i)] = i;
+  auto frozen_hash = freeze(hash_map);
+  auto frozen_tree = freeze(tree_map);
+  hash_map["3"] = tree_map["3"] = -3;
+  hash_map.remove("4");
+  tree_map.remove("4");
+  hash_map = HashMap<std::string, int, 4>();
+  CHECK(frozen_hash.valueOf("3") == 3 && frozen_tree.valueOf("3") == 3);
+  CHECK(frozen_hash.valueOf("4") == 4 && frozen_tree.valueOf("4") == 4);
+  CHECK(frozen_hash.getSize() == 10 && frozen_tree.getSize() == 10);
+}
+
+}
+
+int main()
+{
+  test_against_std_map();
+  test_equal_hashes();
+  test_frozen_copy_is_independent();
+  return test::report("FrozenMapTest");
+}
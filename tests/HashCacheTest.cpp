@@ -0,0 +1,239 @@
+// HashCache: the lru policy against a list kept in recency order, with unit and byte weights,
+// the clock policy against its invariants and the second chance it gives, the statistics, and
+// put hashing its key once whether the key is new or not
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "HashCache.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+std::size_t hash_calls = 0;
+
+struct Key
+{
+  int value;
+
+  bool operator==(const Key& other) const
+  {
+    return value == other.value;
+  }
+
+  bool operator!=(const Key& other) const
+  {
+    return value != other.value;
+  }
+};
+
+}
+
+namespace std
+{
+
+template <>
+struct hash<Key>
+{
+  std::size_t operator()(const Key& key) const
+  {
+    hash_calls++;
+    return std::hash<int>()(key.value);
+  }
+};
+
+}
+
+namespace
+{
+
+struct Bytes
+{
+  std::size_t operator()(const int&, const std::string& value) const
+  {
+    return value.size();
+  }
+};
+
+// the lru cache and a model holding keys from the most to the least recently used
+void test_lru_against_model()
+{
+  for (std::size_t capacity : {1, 2, 3, 8, 50, 200})
+  {
+    HashCache<int, std::string, Bytes> cache(capacity);
+    std::list<int> order;
+    std::unordered_map<int, std::string> model;
+    std::size_t weight = 0, hits = 0, misses = 0, evictions = 0;
+    auto forget = [&](int key)
+    {
+      weight -= model[key].size();
+      model.erase(key);
+      order.remove(key);
+    };
+    std::mt19937 random(static_cast<unsigned>(capacity));
+    for (int step = 0; step < 20000; step++)
+    {
+      int key = static_cast<int>(random() % 40);
+      switch (random() % 4)
+      {
+      case 0:
+      {
+        std::string *value = cache.get(key);
+        CHECK((value != nullptr) == (model.count(key) != 0));
+        if (value != nullptr)
+        {
+          hits++;
+          CHECK(*value == model[key]);
+          order.remove(key);
+          order.push_front(key);
+        }
+        else misses++;
+        break;
+      }
+      case 1:
+        CHECK(cache.contains(key) == (model.count(key) != 0));
+        if (model.count(key) != 0 && random() % 4 == 0)
+        {
+          cache.remove(key);
+          forget(key);
+        }
+        break;
+      default:
+      {
+        std::string value(random() % (capacity + 2), static_cast<char>('a' + step % 26));
+        cache.put(key, value);
+        bool present = model.count(key) != 0;
+        if (present) forget(key);
+        if (value.size() > capacity)
+        {
+          if (present) evictions++; // the old value of the key goes with it
+          break;
+        }
+        model[key] = value;
+        order.push_front(key);
+        weight += value.size();
+        while (weight > capacity)
+        {
+          forget(order.back());
+          evictions++;
+        }
+      }
+      }
+      CHECK(cache.getSize() == model.size());
+      CHECK(cache.getWeight() == weight);
+    }
+    CHECK(cache.hits() == hits);
+    CHECK(cache.misses() == misses);
+    CHECK(cache.evictions() == evictions);
+  }
+}
+
+// the clock cache keeps within its capacity, the entry just written, and the latest values
+void test_clock_invariants()
+{
+  for (std::size_t capacity : {1, 2, 7, 8, 9, 100})
+  {
+    HashCache<int, int> cache(capacity, CachePolicy::clock);
+    std::unordered_map<int, int> written;
+    std::mt19937 random(static_cast<unsigned>(capacity) + 100);
+    for (int step = 0; step < 20000; step++)
+    {
+      int key = static_cast<int>(random() % (4 * capacity + 1));
+      switch (random() % 5)
+      {
+      case 0: case 1:
+      {
+        int *value = cache.get(key);
+        if (value != nullptr) CHECK(*value == written[key]);
+        break;
+      }
+      case 2:
+        if (cache.contains(key)) cache.remove(key);
+        break;
+      default:
+        cache.put(key, step);
+        written[key] = step;
+        CHECK(cache.contains(key));
+      }
+      CHECK(cache.getSize() <= capacity);
+      CHECK(cache.getWeight() == cache.getSize());
+    }
+    cache.clear();
+    CHECK(cache.isEmpty() && cache.getWeight() == 0);
+    cache.put(1, 1);
+    CHECK(cache.contains(1));
+  }
+}
+
+// entries used since the hand last passed them outlive the ones that were not
+void test_clock_second_chance()
+{
+  HashCache<int, int> cache(3, CachePolicy::clock);
+  cache.put(1, 1);
+  cache.put(2, 2);
+  cache.put(3, 3);
+  cache.get(1);
+  cache.get(2);
+  cache.put(4, 4);
+  CHECK(cache.contains(1) && cache.contains(2) && cache.contains(4));
+  CHECK(!cache.contains(3));
+  CHECK(cache.evictions() == 1);
+}
+
+// a value heavier than the whole capacity is not kept and takes the old value of its key along
+void test_overweight_values()
+{
+  HashCache<int, std::string, Bytes> cache(4);
+  cache.put(1, "ab");
+  cache.put(2, "cd");
+  cache.put(1, "too long");
+  CHECK(!cache.contains(1) && cache.contains(2));
+  CHECK(cache.getWeight() == 2);
+  CHECK(cache.evictions() == 1);
+  bool thrown = false;
+  try
+  {
+    HashCache<int, int> empty(0);
+  }
+  catch (const std::invalid_argument&)
+  {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+// put finds or places its key with one lookup
+void test_put_hashes_once()
+{
+  for (CachePolicy policy : {CachePolicy::lru, CachePolicy::clock})
+  {
+    HashCache<Key, int> cache(100000, policy);
+    hash_calls = 0;
+    for (int i = 0; i < 1000; i++) cache.put(Key{i}, i);
+    CHECK(hash_calls == 1000);
+    hash_calls = 0;
+    for (int i = 0; i < 1000; i++) cache.put(Key{i}, -i);
+    CHECK(hash_calls == 1000);
+    CHECK(*cache.get(Key{7}) == -7);
+  }
+}
+
+}
+
+int main()
+{
+  test_lru_against_model();
+  test_clock_invariants();
+  test_clock_second_chance();
+  test_overweight_values();
+  test_put_hashes_once();
+  return test::report("HashCacheTest");
+}
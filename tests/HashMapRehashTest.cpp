@@ -0,0 +1,285 @@
+// incremental rehash of HashMap: lookups, removals, extractions and iterations made while old
+// buckets are still being moved agree with std::unordered_map, switching the incremental rehash
+// off or compacting in the middle of a resize loses nothing, and entries keep their addresses
+// through a resize
+
+#include <chrono>
+#include <random>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "HashMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+using Map = HashMap<int, int>;
+using Reference = std::unordered_map<int, int>;
+
+// a table started with 8 buckets grows to 2048 when its 1025th entry comes in, and each insertion
+// after that moves only a few of the 1024 old buckets, so the resize is under way for a while
+const int initial_buckets = 8;
+const int resize_started = 1025;
+
+bool holds(const Map& map, const Reference& expected)
+{
+  if (map.getSize() != expected.size()) return false;
+  std::set<int> seen;
+  for (auto it = map.begin(); it != map.end(); ++it)
+  {
+    auto found = expected.find(it->first);
+    if (found == expected.end() || found->second != it->second || !seen.insert(it->first).second) return false;
+  }
+  if (seen.size() != expected.size()) return false;
+  std::size_t backwards = 0;
+  for (auto it = map.end(); it != map.begin(); backwards++) --it;
+  return backwards == expected.size();
+}
+
+void fill(Map& map, Reference& expected, int count)
+{
+  for (int key = 0; key < count; key++)
+  {
+    map[key] = key;
+    expected[key] = key;
+  }
+}
+
+// random operations of every kind, with the reference compared often enough to land in the middle of resizes
+void test_random_against_unordered_map()
+{
+  std::mt19937 random(31);
+  for (int round = 0; round < 30; round++)
+  {
+    Map map(1 + round % 9), other;
+    Reference expected;
+    std::unordered_map<int, const int*> addresses; // where values were seen, valid until the next compact()
+    for (int step = 0; step < 6000; step++)
+    {
+      int key = static_cast<int>(random() % 3000);
+      switch (random() % 12)
+      {
+        case 0: case 1: case 2: case 3:
+          map[key] = step;
+          expected[key] = step;
+          addresses[key] = &map.valueOf(key);
+          break;
+        case 4:
+          if (expected.count(key) != 0)
+          {
+            map.remove(key);
+            expected.erase(key);
+            addresses.erase(key);
+          }
+          break;
+        case 5:
+        {
+          auto it = map.find(key);
+          CHECK((it != map.end()) == (expected.count(key) != 0));
+          if (it != map.end()) CHECK(it->second == expected[key]);
+          break;
+        }
+        case 6:
+        {
+          auto handle = map.extract(key);
+          CHECK(static_cast<bool>(handle) == (expected.count(key) != 0));
+          if (handle && random() % 2 == 0)
+          {
+            handle.mapped() = -step;
+            CHECK(map.insert(std::move(handle)).second);
+            expected[key] = -step;
+          }
+          else if (handle)
+          {
+            other.insert(std::move(handle));
+            expected.erase(key);
+          }
+          addresses.erase(key);
+          break;
+        }
+        case 7:
+        {
+          // removes while an iteration is under way, the walk still sees each remaining entry once
+          std::size_t visited = 0, total = expected.size();
+          for (auto it = map.begin(); it != map.end(); visited++)
+          {
+            auto next = it;
+            ++next;
+            if (it->first % 17 == static_cast<int>(step % 17))
+            {
+              expected.erase(it->first);
+              addresses.erase(it->first);
+              map.remove(it);
+            }
+            it = next;
+          }
+          CHECK(visited == total);
+          break;
+        }
+        case 8:
+          if (random() % 20 == 0)
+          {
+            map.set_incremental_rehash(random() % 2 == 0);
+            CHECK(holds(map, expected));
+          }
+          break;
+        case 9:
+          if (random() % 20 == 0)
+          {
+            map.compact(std::chrono::nanoseconds(random() % 2 == 0 ? 1 : 100000));
+            addresses.clear();
+          }
+          break;
+        default:
+          for (const auto& entry : addresses)
+            CHECK(&map.valueOf(entry.first) == entry.second);
+      }
+      if (step % 97 == 0) CHECK(holds(map, expected));
+    }
+    CHECK(holds(map, expected));
+    map.compact();
+    CHECK(holds(map, expected));
+  }
+}
+
+// an iterator or a reference taken just after a resize started stays on its entry while the resize goes on
+void test_iterators_and_references_survive_the_resize()
+{
+  Map map(initial_buckets);
+  Reference expected;
+  fill(map, expected, resize_started);
+  std::vector<std::pair<Map::iterator, const int*>> held;
+  for (int key = 0; key < resize_started; key += 50)
+    held.emplace_back(map.find(key), &map.valueOf(key));
+  for (int key = resize_started; key < 2000; key++)
+  {
+    map[key] = key;
+    expected[key] = key;
+  }
+  for (std::size_t i = 0; i < held.size(); i++)
+  {
+    int key = static_cast<int>(i) * 50;
+    CHECK(held[i].first->first == key);
+    CHECK(&held[i].first->second == held[i].second);
+    CHECK(&map.valueOf(key) == held[i].second);
+  }
+  CHECK(holds(map, expected));
+}
+
+// removing every other entry while walking a table that has just started a resize
+void test_removing_while_iterating_a_resize()
+{
+  for (int count : {9, 17, 65, 129, 257, resize_started, resize_started + 40, 4097})
+    for (int mode = 0; mode < 3; mode++)
+    {
+      Map map(initial_buckets);
+      Reference expected;
+      fill(map, expected, count);
+      std::size_t visited = 0;
+      for (auto it = map.begin(); it != map.end(); visited++)
+      {
+        auto next = it;
+        ++next;
+        if (it->first % 2 == 0)
+        {
+          expected.erase(it->first);
+          if (mode == 0) map.remove(it);
+          else if (mode == 1) map.remove(it->first);
+          else CHECK(static_cast<bool>(map.extract(it)));
+        }
+        it = next;
+      }
+      CHECK(visited == static_cast<std::size_t>(count));
+      CHECK(holds(map, expected));
+    }
+}
+
+// turning the incremental rehash off in the middle of a resize finishes it without moving an entry
+void test_switching_off_mid_resize()
+{
+  Map map(initial_buckets);
+  Reference expected;
+  fill(map, expected, resize_started + 10);
+  std::vector<const int*> addresses;
+  for (int key = 0; key < resize_started + 10; key++) addresses.push_back(&map.valueOf(key));
+  map.set_incremental_rehash(false);
+  CHECK(holds(map, expected));
+  for (int key = 0; key < resize_started + 10; key++) CHECK(&map.valueOf(key) == addresses[key]);
+  for (int key = resize_started + 10; key < 5000; key++)
+  {
+    map[key] = key;
+    expected[key] = key;
+    if (key % 500 == 0) CHECK(holds(map, expected));
+  }
+  map.set_incremental_rehash(true);
+  for (int key = 5000; key < 9000; key++)
+  {
+    map[key] = -key;
+    expected[key] = -key;
+    if (key % 2 == 0)
+    {
+      map.remove(key / 2);
+      expected.erase(key / 2);
+    }
+  }
+  CHECK(holds(map, expected));
+}
+
+// compaction started in the middle of a resize, finished at once or a slice at a time with writes in between
+void test_compacting_mid_resize()
+{
+  {
+    Map map(initial_buckets);
+    Reference expected;
+    fill(map, expected, resize_started + 10);
+    CHECK(map.compact());
+    CHECK(holds(map, expected));
+    for (int key = 0; key < 3000; key += 3)
+    {
+      map[key] = 1;
+      expected[key] = 1;
+    }
+    CHECK(holds(map, expected));
+  }
+  {
+    Map map(initial_buckets);
+    Reference expected;
+    fill(map, expected, resize_started + 10);
+    std::mt19937 random(7);
+    int slices = 0;
+    while (!map.compact(std::chrono::nanoseconds(1)) && slices < 100000)
+    {
+      slices++;
+      int key = static_cast<int>(random() % 4000);
+      if (random() % 3 == 0 && expected.count(key) != 0)
+      {
+        map.remove(key);
+        expected.erase(key);
+      }
+      else
+      {
+        map[key] = slices;
+        expected[key] = slices;
+      }
+      if (slices % 50 == 0) CHECK(holds(map, expected));
+    }
+    CHECK(holds(map, expected));
+  }
+}
+
+}
+
+int main()
+{
+  test_random_against_unordered_map();
+  test_iterators_and_references_survive_the_resize();
+  test_removing_while_iterating_a_resize();
+  test_switching_off_mid_resize();
+  test_compacting_mid_resize();
+  return test::report("HashMapRehashTest");
+}
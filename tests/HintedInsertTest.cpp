@@ -0,0 +1,181 @@
+// hinted insertion into TreeMap against std::map: emplace_hint and insert with the end hint, with
+// the right neighbour and with hints pointing anywhere else, mixed with operator[], removals,
+// snapshots, merges and copies that move or drop the append finger. appending ascending keys
+// through the end hint or operator[] compares a constant number of keys per entry
+
+#include <cstddef>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+using Map = TreeMap<int, int>;
+
+bool holds(const Map& map, const std::map<int, int>& expected)
+{
+  if (map.getSize() != expected.size()) return false;
+  auto it = map.begin();
+  for (const auto& entry : expected)
+  {
+    if (it == map.end() || it->first != entry.first || it->second != entry.second) return false;
+    ++it;
+  }
+  return it == map.end();
+}
+
+// mostly ascending keys, as a sorted ingest would bring, with now and then a key from anywhere
+void test_sorted_ingest_against_std_map()
+{
+  std::mt19937 random(37);
+  for (int round = 0; round < 30; round++)
+  {
+    Map map;
+    std::map<int, int> expected;
+    std::vector<Map::Snapshot> snapshots;
+    int next = 0;
+    for (int step = 0; step < 5000; step++)
+    {
+      switch (random() % 20)
+      {
+      case 0: case 1: case 2: case 3: case 4:
+        next += static_cast<int>(random() % 3);
+        map[next] = step;
+        expected[next] = step;
+        break;
+      case 5: case 6: case 7: case 8:
+      {
+        next += static_cast<int>(random() % 3);
+        auto it = map.emplace_hint(map.end(), next, step);
+        expected.emplace(next, step);
+        CHECK(it->first == next && it->second == expected[next]);
+        break;
+      }
+      case 9: case 10: case 11:
+      {
+        // the hint is the right neighbour of the key or some other entry, the end past the last
+        int key = static_cast<int>(random() % (next + 5));
+        auto hinted = random() % 2 == 0 ? expected.upper_bound(key) : expected.lower_bound(static_cast<int>(random() % (next + 5)));
+        auto it = map.insert(hinted == expected.end() ? map.cend() : map.find(hinted->first), std::make_pair(key, step));
+        expected.insert(std::make_pair(key, step));
+        CHECK(it->first == key && it->second == expected[key]);
+        break;
+      }
+      case 12: case 13: case 14:
+      {
+        int key = static_cast<int>(random() % (next + 5));
+        if (expected.erase(key) != 0) map.remove(key);
+        break;
+      }
+      case 15:
+        if (random() % 20 == 0)
+        {
+          snapshots.push_back(map.snapshot());
+          if (snapshots.size() > 3) snapshots.erase(snapshots.begin());
+        }
+        break;
+      case 16:
+        if (random() % 50 == 0)
+        {
+          Map other;
+          std::map<int, int> merged;
+          for (int i = 0; i < 50; i++)
+          {
+            int key = next + static_cast<int>(random() % 100);
+            other[key] = merged[key] = i;
+          }
+          map.merge(other);
+          expected.insert(merged.begin(), merged.end());
+        }
+        break;
+      case 17:
+        if (random() % 50 == 0)
+        {
+          Map copy(map);
+          CHECK(holds(copy, expected));
+          Map moved(std::move(copy));
+          map = moved;
+        }
+        break;
+      default:
+        if (random() % 20 == 0)
+        {
+          for (auto it = map.begin(); it != map.end(); ++it) it->second++;
+          for (auto& entry : expected) entry.second++;
+        }
+      }
+      if (step % 500 == 0) CHECK(holds(map, expected));
+    }
+    CHECK(holds(map, expected));
+  }
+}
+
+std::size_t comparisons = 0;
+
+struct Key
+{
+  int value;
+
+  bool operator==(const Key& other) const
+  {
+    comparisons++;
+    return value == other.value;
+  }
+
+  bool operator!=(const Key& other) const
+  {
+    comparisons++;
+    return value != other.value;
+  }
+
+  bool operator>(const Key& other) const
+  {
+    comparisons++;
+    return value > other.value;
+  }
+
+  bool operator<(const Key& other) const
+  {
+    comparisons++;
+    return value < other.value;
+  }
+};
+
+// ascending keys are appended next to the last one, not looked up from the root
+void test_appends_compare_few_keys()
+{
+  const int count = 20000;
+  TreeMap<Key, int> hinted, indexed;
+  comparisons = 0;
+  for (int i = 0; i < count; i++) hinted.emplace_hint(hinted.end(), Key{i}, i);
+  CHECK(comparisons <= 4 * count);
+  comparisons = 0;
+  for (int i = 0; i < count; i++) indexed[Key{i}] = i;
+  CHECK(comparisons <= 4 * count);
+  comparisons = 0;
+  TreeMap<Key, int> copy(hinted);
+  CHECK(comparisons <= 4 * count && copy.getSize() == static_cast<std::size_t>(count));
+
+  // a key equal to the last one is found through the hint too
+  auto last = hinted.emplace_hint(hinted.end(), Key{count - 1}, -1);
+  CHECK(last->second == count - 1 && hinted.getSize() == static_cast<std::size_t>(count));
+  int expected = 0;
+  for (auto it = hinted.begin(); it != hinted.end(); ++it, expected++) CHECK(it->first.value == expected && it->second == expected);
+  CHECK(expected == count);
+}
+
+}
+
+int main()
+{
+  test_sorted_ingest_against_std_map();
+  test_appends_compare_few_keys();
+  return test::report("HintedInsertTest");
+}
@@ -0,0 +1,127 @@
+// large maps: PageAllocator blocks of every size, with and without huge pages, zeroed, writable to
+// their end and starting on a cache line, sizes too large to allocate refused, and HashMap and
+// TreeMap with huge pages switched on and off while they grow past a huge page of table and nodes,
+// compared with std::map through resizes, compactions, moves and copies
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <new>
+#include <random>
+#include <type_traits>
+
+#include "HashMap.h"
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+using detail::PageAllocator;
+
+namespace
+{
+
+static_assert(sizeof(HashMap<int, int>::size_type) == 8 && sizeof(TreeMap<int, int>::size_type) == 8, "sizes and bucket counts are 64 bit");
+
+void test_page_allocator()
+{
+  for (std::size_t bytes : {std::size_t(1), std::size_t(7), std::size_t(63), std::size_t(64), std::size_t(100), std::size_t(4096),
+                            std::size_t(1) << 20, (std::size_t(2) << 20) - 64, std::size_t(2) << 20, std::size_t(3) << 20})
+    for (bool huge : {false, true})
+    {
+      char *block = static_cast<char*>(PageAllocator::allocate(bytes, huge));
+      CHECK(reinterpret_cast<std::uintptr_t>(block) % 64 == 0);
+      bool zeroed = true;
+      for (std::size_t i = 0; i < bytes; i++) zeroed = zeroed && block[i] == 0;
+      CHECK(zeroed);
+      block[0] = 1;
+      block[bytes - 1] = 1;
+      PageAllocator::deallocate(block);
+    }
+  PageAllocator::deallocate(nullptr);
+
+  for (bool huge : {false, true})
+  {
+    bool thrown = false;
+    try
+    {
+      PageAllocator::allocate_array<std::uint64_t>(static_cast<std::size_t>(-1) / 4, huge);
+    }
+    catch (const std::bad_alloc&)
+    {
+      thrown = true;
+    }
+    CHECK(thrown);
+    thrown = false;
+    try
+    {
+      PageAllocator::allocate(static_cast<std::size_t>(-1) - 16, huge);
+    }
+    catch (const std::bad_alloc&)
+    {
+      thrown = true;
+    }
+    CHECK(thrown);
+  }
+}
+
+template <typename Map>
+bool holds(const Map& map, const std::map<int, int>& expected, bool ordered)
+{
+  if (map.getSize() != expected.size()) return false;
+  for (const auto& entry : expected)
+  {
+    auto it = map.find(entry.first);
+    if (it == map.end() || it->second != entry.second) return false;
+  }
+  std::size_t seen = 0;
+  auto wanted = expected.begin();
+  for (auto it = map.begin(); it != map.end(); ++it, ++wanted, seen++)
+    if (seen >= expected.size() || (ordered && it->first != wanted->first)) return false;
+  return seen == expected.size();
+}
+
+// the maps grow to a few huge pages of table and nodes while huge pages are switched on and off
+template <typename Map>
+void test_large_map(unsigned seed, bool ordered)
+{
+  std::mt19937 random(seed);
+  Map map;
+  std::map<int, int> expected;
+  for (int phase = 0; phase < 4; phase++)
+  {
+    map.use_huge_pages(phase % 2 == 0);
+    for (int step = 0; step < 60000; step++)
+    {
+      int key = static_cast<int>(random() % 400000);
+      if (random() % 4 == 0)
+      {
+        if (expected.erase(key) != 0) map.remove(key);
+      }
+      else
+      {
+        map[key] = step;
+        expected[key] = step;
+      }
+    }
+    CHECK(holds(map, expected, ordered));
+    CHECK(map.compact());
+    CHECK(holds(map, expected, ordered));
+  }
+  Map moved(std::move(map));
+  Map copy(moved);
+  CHECK(holds(moved, expected, ordered) && copy == moved && map.isEmpty());
+  for (int key = 0; key < 400000; key += 3)
+    if (expected.erase(key) != 0) moved.remove(key);
+  moved.shrink_to_fit();
+  CHECK(holds(moved, expected, ordered));
+}
+
+}
+
+int main()
+{
+  test_page_allocator();
+  test_large_map<HashMap<int, int>>(39, false);
+  test_large_map<TreeMap<int, int>>(40, true);
+  return test::report("HugePagesTest");
+}
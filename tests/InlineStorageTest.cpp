@@ -0,0 +1,159 @@
+// inline storage of HashMap and TreeMap: maps up to their inline capacity keep every entry inside
+// the map object, through removals, copies and moves too, the entries carry over when the
+// map spills to the heap and when it shrinks back, and random work with copies, moves and handles
+// passed between maps of several capacities agrees with std::map
+
+#include <cstddef>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+
+#include "HashMap.h"
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+template <typename Map>
+bool holds(const Map& map, const std::map<int, std::string>& expected, bool ordered)
+{
+  if (map.getSize() != expected.size()) return false;
+  for (const auto& entry : expected)
+  {
+    auto it = map.find(entry.first);
+    if (it == map.end() || it->second != entry.second) return false;
+  }
+  std::size_t seen = 0;
+  auto wanted = expected.begin();
+  for (auto it = map.begin(); it != map.end(); ++it, ++wanted, seen++)
+    if (seen >= expected.size() || (ordered && it->first != wanted->first)) return false;
+  return seen == expected.size();
+}
+
+template <typename Map>
+bool inside(const Map& map, const int *address)
+{
+  const char *first = reinterpret_cast<const char*>(&map), *byte = reinterpret_cast<const char*>(address);
+  return byte >= first && byte < first + sizeof(Map);
+}
+
+// a map within its inline capacity has no node on the heap, whatever is done to it
+template <typename Map>
+void test_small_maps_stay_inside()
+{
+  const int capacity = static_cast<int>(Map::inline_capacity);
+  Map map;
+  for (int key = 0; key < capacity; key++) map[key * 7] = key;
+  for (int key = 0; key < capacity; key += 2) map.remove(key * 7);
+  for (int key = 0; key < capacity; key += 2) map[key * 7] = -key;
+  Map copy(map);
+  Map moved(std::move(copy));
+  copy = moved;
+  map = std::move(moved);
+  CHECK(map.getSize() == static_cast<std::size_t>(capacity) && copy.getSize() == map.getSize());
+  for (int key = 0; key < capacity; key++)
+  {
+    CHECK(map.valueOf(key * 7) == (key % 2 == 0 ? -key : key));
+    CHECK(inside(map, &map.valueOf(key * 7)) && inside(copy, &copy.valueOf(key * 7)));
+  }
+
+  // one entry more spills to the heap, taking every entry along
+  map[-1] = -1;
+  CHECK(!inside(map, &map.valueOf(-1)));
+  CHECK(map.getSize() == static_cast<std::size_t>(capacity) + 1 && map.valueOf(-1) == -1);
+  for (int key = 0; key < capacity; key++) CHECK(map.valueOf(key * 7) == (key % 2 == 0 ? -key : key));
+
+  // a copy of the grown map, back within the capacity, holds every entry inside again
+  map.remove(0);
+  Map small(map);
+  std::size_t kept = 0;
+  for (auto it = small.begin(); it != small.end(); ++it)
+    if (inside(small, &it->second)) kept++;
+  CHECK(small.getSize() == static_cast<std::size_t>(capacity) && kept == small.getSize());
+}
+
+// the maps trade entries, copies and moves while growing past their inline capacity and shrinking
+// below it again
+template <typename Map>
+void test_random_against_std_map(unsigned seed, bool ordered)
+{
+  std::mt19937 random(seed);
+  for (int round = 0; round < 200; round++)
+  {
+    Map maps[3];
+    std::map<int, std::string> expected[3];
+    int keys = static_cast<int>(round % 20) + 3;
+    for (int step = 0; step < 200; step++)
+    {
+      int i = static_cast<int>(random() % 3), j = (i + 1 + static_cast<int>(random() % 2)) % 3;
+      int key = static_cast<int>(random() % keys);
+      switch (random() % 10)
+      {
+      case 0: case 1: case 2: case 3: case 4:
+        maps[i][key] = std::to_string(step);
+        expected[i][key] = std::to_string(step);
+        break;
+      case 5: case 6:
+        if (expected[i].erase(key) != 0) maps[i].remove(key);
+        break;
+      case 7:
+        maps[j] = std::move(maps[i]);
+        expected[j] = std::move(expected[i]);
+        expected[i].clear();
+        break;
+      case 8:
+      {
+        Map copy(maps[i]);
+        maps[j] = copy;
+        expected[j] = expected[i];
+        break;
+      }
+      default:
+      {
+        auto handle = maps[i].extract(key);
+        if (!handle) break;
+        expected[i].erase(key);
+        std::string value = handle.mapped();
+        if (maps[j].insert(std::move(handle)).second) expected[j][key] = value;
+      }
+      }
+      for (int k = 0; k < 3; k++) CHECK(holds(maps[k], expected[k], ordered));
+    }
+  }
+}
+
+// a snapshot of a small tree takes its entries out of the inline storage first
+void test_snapshot_of_small_tree()
+{
+  TreeMap<int, int, 4> map;
+  map[1] = 1;
+  map[2] = 2;
+  auto snapshot = map.snapshot();
+  map[1] = -1;
+  map.remove(2);
+  map[3] = 3;
+  CHECK(snapshot.getSize() == 2 && snapshot.valueOf(1) == 1 && snapshot.valueOf(2) == 2);
+  CHECK(map.getSize() == 2 && map.valueOf(1) == -1 && map.valueOf(3) == 3);
+}
+
+}
+
+int main()
+{
+  test_small_maps_stay_inside<HashMap<int, int, 1>>();
+  test_small_maps_stay_inside<HashMap<int, int, 8>>();
+  test_small_maps_stay_inside<TreeMap<int, int, 1>>();
+  test_small_maps_stay_inside<TreeMap<int, int, 8>>();
+  test_random_against_std_map<HashMap<int, std::string>>(27, false);
+  test_random_against_std_map<HashMap<int, std::string, 3>>(28, false);
+  test_random_against_std_map<HashMap<int, std::string, 32>>(29, false);
+  test_random_against_std_map<TreeMap<int, std::string>>(30, true);
+  test_random_against_std_map<TreeMap<int, std::string, 3>>(31, true);
+  test_random_against_std_map<TreeMap<int, std::string, 8>>(32, true);
+  test_snapshot_of_small_tree();
+  return test::report("InlineStorageTest");
+}
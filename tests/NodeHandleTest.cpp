@@ -0,0 +1,188 @@
+// node handles of HashMap and TreeMap against std::map: entries extracted by key and by iterator
+// and inserted into another map, merges moving everything that does not collide, the entries
+// keeping their addresses on the way, and the handle keeping its entry when its key is taken
+
+#include <cstddef>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "HashMap.h"
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+template <typename Map>
+bool holds(const Map& map, const std::map<int, int>& expected, bool ordered)
+{
+  if (map.getSize() != expected.size()) return false;
+  for (const auto& entry : expected)
+  {
+    auto it = map.find(entry.first);
+    if (it == map.end() || it->second != entry.second) return false;
+  }
+  std::size_t seen = 0;
+  auto wanted = expected.begin();
+  for (auto it = map.begin(); it != map.end(); ++it, ++wanted, seen++)
+    if (seen >= expected.size() || (ordered && it->first != wanted->first)) return false;
+  return seen == expected.size();
+}
+
+template <typename Map>
+void fill(Map& map, std::map<int, int>& expected, std::mt19937& random, int offset)
+{
+  for (int i = 0; i < 60; i++)
+  {
+    int key = static_cast<int>(random() % 200) + offset;
+    map[key] = i;
+    expected[key] = i;
+  }
+}
+
+// entries go back and forth between two maps one handle at a time. nodes on the heap are handed
+// over as they are, nodes in the inline storage are moved to the heap once, when extracted
+template <typename Map>
+void test_extract_and_insert(unsigned seed, bool ordered)
+{
+  const bool inline_storage = Map::inline_capacity != 0;
+  std::mt19937 random(seed);
+  for (int round = 0; round < 100; round++)
+  {
+    Map maps[2];
+    std::map<int, int> expected[2];
+    fill(maps[0], expected[0], random, 0);
+    fill(maps[1], expected[1], random, 100);
+    for (int step = 0; step < 200; step++)
+    {
+      int from = static_cast<int>(random() % 2), to = 1 - from;
+      int key = static_cast<int>(random() % 300);
+      auto found = maps[from].find(key);
+      const int *address = found == maps[from].end() ? nullptr : &found->second;
+      typename Map::node_type handle = random() % 2 == 0 || found == maps[from].end()
+          ? maps[from].extract(key) : maps[from].extract(found);
+      CHECK(handle.empty() == (expected[from].count(key) == 0));
+      if (handle.empty()) continue;
+      CHECK(handle.key() == key && handle.mapped() == expected[from][key]);
+      if (!inline_storage) CHECK(&handle.mapped() == address);
+      address = &handle.mapped();
+      int value = expected[from][key];
+      expected[from].erase(key);
+      auto result = maps[to].insert(std::move(handle));
+      if (expected[to].count(key) == 0)
+      {
+        CHECK(result.second && handle.empty());
+        CHECK(&result.first->second == address);
+        expected[to][key] = value;
+      }
+      else
+      {
+        // the key is taken, the handle still holds the entry and can be put back
+        CHECK(!result.second && !handle.empty());
+        CHECK(result.first->first == key && result.first->second == expected[to][key]);
+        CHECK(handle.key() == key && handle.mapped() == value && &handle.mapped() == address);
+        CHECK(maps[from].insert(std::move(handle)).second);
+        expected[from][key] = value;
+      }
+      if (step % 20 == 0) CHECK(holds(maps[0], expected[0], ordered) && holds(maps[1], expected[1], ordered));
+    }
+    CHECK(holds(maps[0], expected[0], ordered) && holds(maps[1], expected[1], ordered));
+  }
+}
+
+// the map merged into keeps its entries, takes the others with their nodes and leaves the
+// colliding ones where they were. the key ranges cover both overlapping and disjoint maps
+template <typename Map>
+void test_merge(unsigned seed, bool ordered)
+{
+  const bool inline_storage = Map::inline_capacity != 0;
+  std::mt19937 random(seed);
+  for (int round = 0; round < 300; round++)
+  {
+    Map target, source;
+    std::map<int, int> expected_target, expected_source;
+    int offset = (round % 4 == 0) ? 1000 : (round % 4 == 1 ? -1000 : static_cast<int>(random() % 150));
+    if (round % 7 != 0) fill(target, expected_target, random, 0);
+    if (round % 11 != 0) fill(source, expected_source, random, offset);
+    for (int i = 0; i < 20; i++)
+    {
+      int key = static_cast<int>(random() % 200) + offset;
+      if (expected_source.erase(key) != 0) source.remove(key);
+    }
+    std::map<int, const int*> addresses;
+    for (auto it = source.begin(); it != source.end(); ++it) addresses[it->first] = &it->second;
+
+    target.merge(source);
+    std::map<int, int> left;
+    for (const auto& entry : expected_source)
+    {
+      if (expected_target.count(entry.first) != 0) left.insert(entry);
+      else expected_target.insert(entry);
+    }
+    CHECK(holds(target, expected_target, ordered));
+    CHECK(holds(source, left, ordered));
+    if (!inline_storage)
+      for (const auto& entry : expected_source)
+        if (left.count(entry.first) == 0) CHECK(&target.find(entry.first)->second == addresses[entry.first]);
+
+    target.merge(target);
+    CHECK(holds(target, expected_target, ordered));
+  }
+}
+
+// empty handles: a missing key, the end iterator and an empty handle inserted
+template <typename Map>
+void test_empty_handles()
+{
+  Map map;
+  map[1] = 1;
+  CHECK(map.extract(2).empty());
+  typename Map::node_type handle;
+  CHECK(handle.empty() && !handle);
+  auto result = map.insert(std::move(handle));
+  CHECK(!result.second && result.first == map.end());
+  bool thrown = false;
+  try
+  {
+    handle.key();
+  }
+  catch (const std::out_of_range&)
+  {
+    thrown = true;
+  }
+  CHECK(thrown);
+  thrown = false;
+  try
+  {
+    map.extract(map.cend());
+  }
+  catch (const std::out_of_range&)
+  {
+    thrown = true;
+  }
+  CHECK(thrown);
+  CHECK(map.getSize() == 1);
+  handle = map.extract(map.cbegin());
+  CHECK(handle && handle.key() == 1 && map.getSize() == 0);
+}
+
+}
+
+int main()
+{
+  test_extract_and_insert<HashMap<int, int>>(26, false);
+  test_extract_and_insert<HashMap<int, int, 4>>(27, false);
+  test_extract_and_insert<TreeMap<int, int>>(28, true);
+  test_extract_and_insert<TreeMap<int, int, 4>>(29, true);
+  test_merge<HashMap<int, int>>(30, false);
+  test_merge<HashMap<int, int, 4>>(31, false);
+  test_merge<TreeMap<int, int>>(32, true);
+  test_merge<TreeMap<int, int, 4>>(33, true);
+  test_empty_handles<HashMap<int, int>>();
+  test_empty_handles<TreeMap<int, int>>();
+  return test::report("NodeHandleTest");
+}
@@ -0,0 +1,257 @@
+// parallel_for_each, parallel_reduce and parallel_erase_if of HashMap and TreeMap against a
+// sequential std::map, over tree shapes a plain cut cannot split (sorted inserts, copies) and
+// hash tables caught in the middle of a resize, and with predicates that throw
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "HashMap.h"
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+using Reference = std::map<int, long>;
+
+const unsigned thread_counts[] = {1, 2, 3, 8};
+
+template <typename Map>
+bool holds(const Map& map, const Reference& expected)
+{
+  if (map.getSize() != expected.size()) return false;
+  std::size_t seen = 0;
+  for (auto it = map.begin(); it != map.end(); ++it, seen++)
+  {
+    auto found = expected.find(it->first);
+    if (found == expected.end() || found->second != it->second) return false;
+  }
+  return seen == expected.size();
+}
+
+template <typename Map>
+void fill(Map& map, Reference& expected, const std::vector<int>& keys)
+{
+  for (int key : keys)
+  {
+    map[key] = key * 3L;
+    expected[key] = key * 3L;
+  }
+}
+
+std::vector<int> shuffled(int count, unsigned seed)
+{
+  std::vector<int> keys;
+  std::mt19937 random(seed);
+  for (int i = 0; i < count; i++) keys.push_back(static_cast<int>(random() % (4 * count)));
+  return keys;
+}
+
+std::vector<int> ascending(int count)
+{
+  std::vector<int> keys;
+  for (int i = 0; i < count; i++) keys.push_back(2 * i);
+  return keys;
+}
+
+std::vector<int> descending(int count)
+{
+  std::vector<int> keys;
+  for (int i = count; i > 0; i--) keys.push_back(2 * i);
+  return keys;
+}
+
+// all three operations on one map, checked against the reference
+template <typename Map>
+void check_operations(Map& map, Reference expected, unsigned threads)
+{
+  std::atomic<long> key_sum(0);
+  std::atomic<std::size_t> visited(0);
+  const Map& view = map;
+  view.parallel_for_each([&](const typename Map::value_type& entry)
+  {
+    key_sum += entry.first;
+    visited++;
+  }, threads);
+  long expected_sum = 0;
+  for (const auto& entry : expected) expected_sum += entry.first;
+  CHECK(visited == expected.size());
+  CHECK(key_sum == expected_sum);
+
+  map.parallel_for_each([](typename Map::value_type& entry) { entry.second += 1; }, threads);
+  for (auto& entry : expected) entry.second += 1;
+  CHECK(holds(map, expected));
+
+  long total = map.parallel_reduce(0L, [](long sum, const typename Map::value_type& entry) { return sum + entry.second; },
+                                   [](long left, long right) { return left + right; }, threads);
+  long expected_total = 0;
+  for (const auto& entry : expected) expected_total += entry.second;
+  CHECK(total == expected_total);
+
+  std::size_t removed = map.parallel_erase_if([](const typename Map::value_type& entry) { return entry.first % 3 == 0; }, threads);
+  std::size_t expected_removed = 0;
+  for (auto it = expected.begin(); it != expected.end();)
+    if (it->first % 3 == 0)
+    {
+      it = expected.erase(it);
+      expected_removed++;
+    }
+    else ++it;
+  CHECK(removed == expected_removed);
+  CHECK(holds(map, expected));
+}
+
+void test_tree_shapes()
+{
+  for (unsigned threads : thread_counts)
+  {
+    std::vector<std::vector<int>> shapes = {shuffled(5000, threads), ascending(5000), descending(5000), ascending(10)};
+    for (const auto& keys : shapes)
+    {
+      TreeMap<int, long> map;
+      Reference expected;
+      fill(map, expected, keys);
+      check_operations(map, expected, threads);
+    }
+    TreeMap<int, long> source;
+    Reference expected;
+    fill(source, expected, shuffled(5000, 7));
+    TreeMap<int, long> copy(source); // copies are built by appending, a single right spine
+    check_operations(copy, expected, threads);
+  }
+}
+
+void test_hash_tables()
+{
+  for (unsigned threads : thread_counts)
+    for (int count : {0, 1, 100, 5000, 5003})
+    {
+      HashMap<int, long> map(8); // grows a lot, some counts leave a resize under way
+      Reference expected;
+      fill(map, expected, shuffled(count, threads + 1));
+      check_operations(map, expected, threads);
+    }
+}
+
+// entries are handed out to several threads even when the tree is one long spine
+void test_spine_is_spread()
+{
+  TreeMap<int, long> map;
+  Reference expected;
+  fill(map, expected, ascending(4000));
+  std::mutex lock;
+  std::map<std::thread::id, std::size_t> per_thread;
+  map.parallel_for_each([&](const TreeMap<int, long>::value_type&)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+    std::lock_guard<std::mutex> guard(lock);
+    per_thread[std::this_thread::get_id()]++;
+  }, 4);
+  std::size_t busiest = 0;
+  for (const auto& entry : per_thread)
+    if (entry.second > busiest) busiest = entry.second;
+  CHECK(per_thread.size() > 1);
+  CHECK(busiest < 3000);
+}
+
+struct Failure : std::runtime_error
+{
+  Failure(): std::runtime_error("predicate failed") {}
+};
+
+// a throwing predicate leaves a consistent map: only matching entries may be gone and it keeps working
+template <typename Map>
+void check_throwing_predicate(Map& map, Reference expected, unsigned threads)
+{
+  bool thrown = false;
+  try
+  {
+    map.parallel_erase_if([](const typename Map::value_type& entry)
+    {
+      if (entry.first == 998) throw Failure();
+      return entry.first % 2 == 0 && entry.first % 4 != 0;
+    }, threads);
+  }
+  catch (const Failure&)
+  {
+    thrown = true;
+  }
+  CHECK(thrown);
+
+  std::size_t seen = 0;
+  for (auto it = map.begin(); it != map.end(); ++it, seen++)
+    CHECK(expected.count(it->first) == 1);
+  CHECK(seen == map.getSize());
+  for (auto it = expected.begin(); it != expected.end();)
+  {
+    bool matched = it->first % 2 == 0 && it->first % 4 != 0 && it->first != 998;
+    bool present = map.find(it->first) != map.end();
+    CHECK(present || matched);
+    if (!present) it = expected.erase(it);
+    else ++it;
+  }
+
+  std::mt19937 random(threads);
+  for (int step = 0; step < 2000; step++)
+  {
+    int key = static_cast<int>(random() % 3000);
+    if (random() % 2 == 0)
+    {
+      map[key] = step;
+      expected[key] = step;
+    }
+    else if (expected.count(key) != 0)
+    {
+      map.remove(key);
+      expected.erase(key);
+    }
+  }
+  CHECK(holds(map, expected));
+}
+
+void test_throwing_predicates()
+{
+  for (unsigned threads : thread_counts)
+  {
+    std::vector<int> keys = ascending(1500);
+    {
+      HashMap<int, long> map;
+      Reference expected;
+      fill(map, expected, keys);
+      check_throwing_predicate(map, expected, threads);
+    }
+    {
+      TreeMap<int, long> map;
+      Reference expected;
+      fill(map, expected, keys);
+      check_throwing_predicate(map, expected, threads);
+    }
+    {
+      TreeMap<int, long> map;
+      Reference expected;
+      fill(map, expected, shuffled(1500, 3));
+      map[998] = 0;
+      expected[998] = 0;
+      check_throwing_predicate(map, expected, threads);
+    }
+  }
+}
+
+}
+
+int main()
+{
+  test_tree_shapes();
+  test_hash_tables();
+  test_spine_is_spread();
+  test_throwing_predicates();
+  return test::report("ParallelTest");
+}
@@ -0,0 +1,175 @@
+// RadixTreeMap against std::map: insertions, whose single descent also has to find the leaf the
+// new one is linked in front of, removals, bounds, range and prefix scans and iteration both ways,
+// for key types of every width, signed and unsigned, on dense, sparse and clustered keys
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "RadixTreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+template <typename Key>
+bool holds(const RadixTreeMap<Key, int>& map, const std::map<Key, int>& expected)
+{
+  if (map.getSize() != expected.size()) return false;
+  auto it = map.begin();
+  for (const auto& entry : expected)
+  {
+    if (it == map.end() || it->first != entry.first || it->second != entry.second) return false;
+    ++it;
+  }
+  if (it != map.end()) return false;
+  auto back = expected.rbegin();
+  for (auto it = map.end(); it != map.begin(); ++back)
+  {
+    --it;
+    if (back == expected.rend() || it->first != back->first) return false;
+  }
+  return back == expected.rend();
+}
+
+// keys drawn so that they share long prefixes, split compressed paths and fill wide nodes
+template <typename Key>
+Key draw(std::mt19937_64& random, int shape)
+{
+  std::uint64_t bits = random();
+  switch (shape)
+  {
+  case 0:
+    return static_cast<Key>(bits); // anywhere
+  case 1:
+    return static_cast<Key>(bits % 300); // dense, around zero
+  case 2:
+    return static_cast<Key>(-static_cast<std::int64_t>(bits % 300)); // dense, negative
+  default:
+    // a few clusters far apart, keys inside differ in their low bytes only
+    return static_cast<Key>((bits % 4) * 0x0101010101010101ull + ((bits >> 8) % 2000) * ((bits >> 20) % 2 == 0 ? 1 : 257));
+  }
+}
+
+template <typename Key>
+void test_random_against_std_map(unsigned seed)
+{
+  std::mt19937_64 random(seed);
+  for (int round = 0; round < 40; round++)
+  {
+    int shape = round % 4;
+    RadixTreeMap<Key, int> map;
+    std::map<Key, int> expected;
+    for (int step = 0; step < 1500; step++)
+    {
+      Key key = draw<Key>(random, shape);
+      switch (random() % 8)
+      {
+      case 0: case 1: case 2: case 3:
+        map[key] += step;
+        expected[key] += step;
+        break;
+      case 4:
+        if (expected.count(key) != 0)
+        {
+          map.remove(key);
+          expected.erase(key);
+        }
+        else
+        {
+          bool thrown = false;
+          try
+          {
+            map.remove(key);
+          }
+          catch (const std::out_of_range&)
+          {
+            thrown = true;
+          }
+          CHECK(thrown);
+        }
+        break;
+      case 5:
+      {
+        auto found = map.find(key);
+        CHECK((found != map.end()) == (expected.count(key) != 0));
+        auto lower = map.lower_bound(key);
+        auto upper = map.upper_bound(key);
+        auto expected_lower = expected.lower_bound(key);
+        auto expected_upper = expected.upper_bound(key);
+        CHECK(lower == map.end() ? expected_lower == expected.end() : expected_lower != expected.end() && lower->first == expected_lower->first);
+        CHECK(upper == map.end() ? expected_upper == expected.end() : expected_upper != expected.end() && upper->first == expected_upper->first);
+        break;
+      }
+      case 6:
+      {
+        Key other = draw<Key>(random, shape);
+        Key first = key < other ? key : other, last = key < other ? other : key;
+        std::vector<Key> seen, wanted;
+        map.for_each_in_range(first, last, [&](const typename RadixTreeMap<Key, int>::value_type& entry) { seen.push_back(entry.first); });
+        for (auto it = expected.lower_bound(first); it != expected.lower_bound(last); ++it) wanted.push_back(it->first);
+        CHECK(seen == wanted);
+        break;
+      }
+      default:
+      {
+        int prefix_bits = static_cast<int>(random() % (8 * sizeof(Key) + 1));
+        std::vector<Key> seen, wanted;
+        map.for_each_with_prefix(key, prefix_bits, [&](const typename RadixTreeMap<Key, int>::value_type& entry) { seen.push_back(entry.first); });
+        int free_bits = static_cast<int>(8 * sizeof(Key)) - prefix_bits;
+        for (const auto& entry : expected)
+        {
+          std::uint64_t difference = static_cast<std::uint64_t>(entry.first) ^ static_cast<std::uint64_t>(key);
+          if (free_bits >= 64 || ((difference & (~std::uint64_t(0) >> (64 - 8 * sizeof(Key)))) >> free_bits) == 0)
+            wanted.push_back(entry.first);
+        }
+        CHECK(seen == wanted);
+      }
+      }
+      if (step % 100 == 0) CHECK(holds(map, expected));
+    }
+    CHECK(holds(map, expected));
+    RadixTreeMap<Key, int> copy(map);
+    CHECK(copy == map);
+    CHECK(holds(copy, expected));
+  }
+}
+
+// every insertion order of a small key set links the leaves in key order
+void test_insertion_orders()
+{
+  std::vector<int> keys = {0, 1, 255, 256, 257, 65535, 65536, -1, -256, 1 << 24, (1 << 24) + 1, 0x7fffffff, -0x7fffffff - 1};
+  std::mt19937 random(36);
+  for (int order = 0; order < 500; order++)
+  {
+    std::shuffle(keys.begin(), keys.end(), random);
+    RadixTreeMap<int, int> map;
+    std::map<int, int> expected;
+    for (int key : keys)
+    {
+      map[key] = key;
+      expected[key] = key;
+      CHECK(holds(map, expected));
+    }
+  }
+}
+
+}
+
+int main()
+{
+  test_random_against_std_map<std::int8_t>(1);
+  test_random_against_std_map<std::uint16_t>(2);
+  test_random_against_std_map<int>(3);
+  test_random_against_std_map<unsigned>(4);
+  test_random_against_std_map<long long>(5);
+  test_random_against_std_map<std::uint64_t>(6);
+  test_insertion_orders();
+  return test::report("RadixTreeMapTest");
+}
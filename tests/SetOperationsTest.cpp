@@ -0,0 +1,192 @@
+// equality and set operations of HashMap and TreeMap against std::map: pairs of maps with keys
+// overlapping a lot, a little or not at all, built in different orders and with different bucket
+// counts, compared, united, intersected, subtracted and diffed, and a map combined with itself
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "HashMap.h"
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+template <typename Map>
+bool holds(const Map& map, const std::map<int, int>& expected, bool ordered)
+{
+  if (map.getSize() != expected.size()) return false;
+  for (const auto& entry : expected)
+  {
+    auto it = map.find(entry.first);
+    if (it == map.end() || it->second != entry.second) return false;
+  }
+  std::size_t seen = 0;
+  auto wanted = expected.begin();
+  for (auto it = map.begin(); it != map.end(); ++it, ++wanted, seen++)
+    if (seen >= expected.size() || (ordered && it->first != wanted->first)) return false;
+  return seen == expected.size();
+}
+
+// the map holding the entries of expected, inserted in a random order
+template <typename Map>
+Map build(const std::map<int, int>& expected, std::mt19937& random, std::size_t buckets)
+{
+  std::vector<std::pair<int, int>> entries(expected.begin(), expected.end());
+  std::shuffle(entries.begin(), entries.end(), random);
+  Map map(buckets);
+  for (const auto& entry : entries) map[entry.first] = entry.second;
+  return map;
+}
+
+template <typename Map>
+Map build(const std::map<int, int>& expected, std::mt19937& random)
+{
+  return build<Map>(expected, random, 10 + random() % 2000);
+}
+
+template <>
+TreeMap<int, int> build<TreeMap<int, int>>(const std::map<int, int>& expected, std::mt19937& random)
+{
+  std::vector<std::pair<int, int>> entries(expected.begin(), expected.end());
+  std::shuffle(entries.begin(), entries.end(), random);
+  TreeMap<int, int> map;
+  for (const auto& entry : entries) map[entry.first] = entry.second;
+  return map;
+}
+
+std::map<int, int> draw(std::mt19937& random, int size, int first, int span)
+{
+  std::map<int, int> drawn;
+  for (int i = 0; i < size; i++) drawn[first + static_cast<int>(random() % span)] = static_cast<int>(random() % 4);
+  return drawn;
+}
+
+std::vector<int> sorted(std::vector<int> keys)
+{
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
+template <typename Map>
+void test_against_std_map(unsigned seed, bool ordered)
+{
+  std::mt19937 random(seed);
+  for (int round = 0; round < 400; round++)
+  {
+    int size = static_cast<int>(random() % (round < 40 ? 4 : 300));
+    std::map<int, int> left = draw(random, size, 0, 2 * size + 1);
+    std::map<int, int> right;
+    switch (round % 4)
+    {
+    case 0: right = left; break; // equal, or differing in a few values below
+    case 1: right = draw(random, size, 0, 2 * size + 1); break;
+    case 2: right = draw(random, size, 10 * size + 10, 2 * size + 1); break; // disjoint
+    default: right = draw(random, static_cast<int>(random() % 5), -2, 2 * size + 4); // far smaller
+    }
+    if (round % 8 == 0 && !right.empty()) right.begin()->second += 10;
+    Map a = build<Map>(left, random), b = build<Map>(right, random);
+
+    CHECK((a == b) == (left == right) && (a != b) == (left != right));
+    CHECK(a == build<Map>(left, random) && b == build<Map>(right, random));
+
+    std::map<int, int> united = left, intersected, subtracted;
+    united.insert(right.begin(), right.end());
+    std::vector<int> added, removed, changed;
+    for (const auto& entry : left)
+    {
+      auto match = right.find(entry.first);
+      if (match == right.end())
+      {
+        subtracted.insert(entry);
+        removed.push_back(entry.first);
+      }
+      else
+      {
+        intersected.insert(entry);
+        if (match->second != entry.second) changed.push_back(entry.first);
+      }
+    }
+    for (const auto& entry : right)
+      if (left.count(entry.first) == 0) added.push_back(entry.first);
+
+    auto difference = a.difference(b);
+    CHECK(holds(difference, subtracted, ordered));
+    auto diff = a.diff(b);
+    if (ordered) CHECK(diff.added == added && diff.removed == removed && diff.changed == changed);
+    else CHECK(sorted(diff.added) == added && sorted(diff.removed) == removed && sorted(diff.changed) == changed);
+
+    Map united_map(a);
+    united_map.union_with(b);
+    CHECK(holds(united_map, united, ordered));
+    Map intersected_map(a);
+    intersected_map.intersect_with(b);
+    CHECK(holds(intersected_map, intersected, ordered));
+    CHECK(holds(a, left, ordered) && holds(b, right, ordered));
+
+    // a map combined with itself
+    Map self(a);
+    self.union_with(self);
+    CHECK(holds(self, left, ordered));
+    self.intersect_with(self);
+    CHECK(holds(self, left, ordered));
+    CHECK(self.difference(self).isEmpty() && self == self);
+    auto none = self.diff(self);
+    CHECK(none.added.empty() && none.removed.empty() && none.changed.empty());
+  }
+}
+
+// tables of different sizes compare by content, also while one of them is growing
+void test_hash_maps_of_different_layouts()
+{
+  HashMap<int, int> small(1), large(5000);
+  for (int key = 0; key < 3000; key++)
+  {
+    small[key] = key;
+    large[2999 - key] = 2999 - key;
+  }
+  CHECK(small == large && large == small);
+  HashMap<int, int> growing(1), other(5000);
+  for (int key = 0; key < 3000; key++)
+  {
+    growing[key] = key;
+    other[key] = key;
+    if (key % 97 == 0) CHECK(growing == other && other == growing);
+  }
+  large[17] = -17;
+  CHECK(small != large);
+  auto diff = small.diff(large);
+  CHECK(diff.added.empty() && diff.removed.empty() && diff.changed == std::vector<int>{17});
+}
+
+// set operations write into a tree shared with a snapshot without touching the snapshot
+void test_tree_with_snapshot()
+{
+  TreeMap<int, int> map, other;
+  for (int key = 0; key < 100; key++)
+  {
+    map[2 * key] = key;
+    other[3 * key] = -key;
+  }
+  auto snapshot = map.snapshot();
+  map.union_with(other);
+  map.intersect_with(other);
+  CHECK(map.getSize() == 100);
+  CHECK(snapshot.getSize() == 100 && snapshot.valueOf(2) == 1 && snapshot.find(3) == snapshot.end());
+}
+
+}
+
+int main()
+{
+  test_against_std_map<HashMap<int, int>>(28, false);
+  test_against_std_map<TreeMap<int, int>>(29, true);
+  test_hash_maps_of_different_layouts();
+  test_tree_with_snapshot();
+  return test::report("SetOperationsTest");
+}
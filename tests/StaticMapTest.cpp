@@ -0,0 +1,118 @@
+// StaticMap: lookups, bounds and the sorted order checked at compile time by static_assert, the
+// constructor run at run time on shuffled key sets and compared with std::map, and duplicate keys
+// rejected, at compile time by failing to compile and at run time by an exception
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <random>
+#include <stdexcept>
+
+#include "StaticMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+constexpr auto opcodes = make_static_map<int, char>({{0x10, 'a'}, {0x02, 'b'}, {7, 'c'}, {-3, 'd'}, {0x7fffffff, 'e'}});
+
+static_assert(opcodes.getSize() == 5 && !opcodes.isEmpty(), "every entry is kept");
+static_assert(opcodes.valueOf(7) == 'c' && opcodes.valueOf(-3) == 'd' && opcodes.valueOf(0x7fffffff) == 'e', "keys map to their values");
+static_assert(!opcodes.contains(5) && opcodes.find(5) == opcodes.end() && opcodes.find(-4) == opcodes.end(), "other keys are missing");
+static_assert(opcodes.begin()->first == -3 && (opcodes.end() - 1)->first == 0x7fffffff, "entries are sorted");
+static_assert(opcodes.lower_bound(3)->first == 7 && opcodes.lower_bound(-100) == opcodes.begin(), "bounds");
+static_assert(opcodes.lower_bound(0x10)->first == 0x10, "a bound on a present key is the key");
+
+// a lookup may size an array, so it has to be a constant expression
+char table[opcodes.valueOf(0x10) - 'a' + 3];
+static_assert(sizeof(table) == 3, "the lookup is folded");
+
+enum class Color { red, green, blue };
+
+constexpr auto names = make_static_map<Color, char>({{Color::blue, 'b'}, {Color::red, 'r'}, {Color::green, 'g'}});
+static_assert(names.valueOf(Color::green) == 'g' && names.begin()->first == Color::red, "enum keys");
+
+constexpr auto single = make_static_map<long, int>({{42, 1}});
+static_assert(single.contains(42) && !single.contains(41) && single.lower_bound(43) == single.end(), "one entry");
+
+// a second entry for a key stops the build, a duplicate would not compile here:
+// constexpr auto duplicated = make_static_map<int, int>({{1, 1}, {1, 2}});
+
+template <std::size_t Count>
+void test_against_std_map(std::mt19937& random)
+{
+  for (int round = 0; round < 300; round++)
+  {
+    StaticEntry<int, int> list[Count];
+    std::map<int, int> expected;
+    int span = round % 2 == 0 ? static_cast<int>(Count) * 3 : 1 << 30;
+    for (std::size_t i = 0; i < Count; i++)
+    {
+      int key;
+      do key = static_cast<int>(random() % span) - span / 2;
+      while (expected.count(key) != 0);
+      list[i] = StaticEntry<int, int>{key, static_cast<int>(random())};
+      expected[key] = list[i].second;
+    }
+    if (round % 3 == 0) std::sort(list, list + Count, [](const StaticEntry<int, int>& a, const StaticEntry<int, int>& b) { return a.first > b.first; });
+
+    StaticMap<int, int, Count> map(list);
+    CHECK(map.getSize() == Count);
+    auto wanted = expected.begin();
+    for (auto it = map.begin(); it != map.end(); ++it, ++wanted)
+      CHECK(it->first == wanted->first && it->second == wanted->second);
+    for (int probe = 0; probe < 50; probe++)
+    {
+      int key = probe % 2 == 0 ? list[random() % Count].first + static_cast<int>(random() % 3) - 1 : static_cast<int>(random() % span) - span / 2;
+      bool present = expected.count(key) != 0;
+      CHECK(map.contains(key) == present);
+      CHECK(present ? map.find(key)->second == expected[key] : map.find(key) == map.end());
+      auto lower = map.lower_bound(key);
+      auto expected_lower = expected.lower_bound(key);
+      CHECK(lower == map.end() ? expected_lower == expected.end() : expected_lower != expected.end() && lower->first == expected_lower->first);
+      bool thrown = false;
+      try
+      {
+        CHECK(map.valueOf(key) == expected[key]);
+      }
+      catch (const std::out_of_range&)
+      {
+        thrown = true;
+      }
+      CHECK(thrown == !present);
+    }
+  }
+}
+
+// built at run time, a duplicate key throws
+void test_duplicate_key()
+{
+  StaticEntry<int, int> list[] = {{3, 0}, {1, 0}, {2, 0}, {1, 1}};
+  bool thrown = false;
+  try
+  {
+    StaticMap<int, int, 4> map(list);
+  }
+  catch (const std::invalid_argument&)
+  {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+}
+
+int main()
+{
+  std::mt19937 random(33);
+  test_against_std_map<1>(random);
+  test_against_std_map<2>(random);
+  test_against_std_map<7>(random);
+  test_against_std_map<64>(random);
+  test_against_std_map<1000>(random);
+  test_duplicate_key();
+  CHECK(opcodes.valueOf(2) == 'b' && sizeof(table) == 3);
+  return test::report("StaticMapTest");
+}
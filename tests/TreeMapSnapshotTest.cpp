@@ -0,0 +1,290 @@
+// copy-on-write snapshots of TreeMap: writes never show through a snapshot, whatever way they
+// take, lookups and iterators copy only the paths they need, and the map goes back to its
+// unshared fast paths once the last snapshot is gone
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "TreeMap.h"
+#include "Check.h"
+
+using namespace aisdi;
+
+namespace
+{
+
+using Map = TreeMap<int, int>;
+
+// counts copies, which is what cloning a shared node costs
+struct Counted
+{
+  static std::size_t copies;
+  int value;
+
+  Counted(): value(0) {}
+  Counted(int value): value(value) {}
+  Counted(const Counted& other): value(other.value) { copies++; }
+  Counted& operator=(const Counted& other) = default;
+};
+
+std::size_t Counted::copies = 0;
+
+void fill(Map& map)
+{
+  for (int key : {10, 5, 15, 3, 7, 12, 18, 1, 4, 6, 8, 11, 13, 17, 19, 0, 2, 9, 14, 16}) map[key] = key;
+}
+
+template <typename Snapshot>
+bool holds(const Snapshot& snapshot, const std::map<int, int>& expected)
+{
+  if (snapshot.getSize() != expected.size()) return false;
+  auto it = snapshot.begin();
+  for (const auto& entry : expected)
+  {
+    if (it == snapshot.end() || it->first != entry.first || it->second != entry.second) return false;
+    ++it;
+  }
+  return it == snapshot.end();
+}
+
+// every way of writing through an iterator leaves the snapshot alone
+void test_writes_through_iterators()
+{
+  {
+    Map map;
+    fill(map);
+    auto snapshot = map.snapshot();
+    auto it = map.find(5);
+    ++it;
+    it->second = 999;
+    CHECK(snapshot.valueOf(6) == 6);
+    CHECK(map.valueOf(6) == 999);
+  }
+  {
+    Map map;
+    fill(map);
+    auto snapshot = map.snapshot();
+    auto last = map.end();
+    --last;
+    last->second = -5;
+    CHECK(snapshot.valueOf(19) == 19);
+    CHECK(map.valueOf(19) == -5);
+  }
+  {
+    Map map, other;
+    fill(map);
+    auto snapshot = map.snapshot();
+    other[3] = 0;
+    map.insert(other.extract(3)).first->second = 12345;
+    CHECK(snapshot.valueOf(3) == 3);
+    CHECK(map.valueOf(3) == 12345);
+  }
+  {
+    Map map;
+    fill(map);
+    auto snapshot = map.snapshot();
+    auto it = map.insert(map.cend(), std::make_pair(20, 20));
+    --it;
+    it->second = 7;
+    CHECK(snapshot.valueOf(19) == 19);
+    it = map.emplace_hint(map.cbegin(), 5, 0);
+    ++it;
+    it->second = 7;
+    CHECK(snapshot.valueOf(6) == 6);
+  }
+  {
+    Map map;
+    fill(map);
+    auto snapshot = map.snapshot();
+    for (auto it = map.begin(); it != map.end(); ++it) it->second = -it->second;
+    CHECK(snapshot.valueOf(19) == 19 && map.valueOf(19) == -19);
+    CHECK(snapshot.valueOf(0) == 0 && snapshot.valueOf(9) == 9);
+  }
+}
+
+// an iterator placed while a snapshot is alive stays valid while other writes copy their paths
+void test_iterators_survive_other_writes()
+{
+  Map map;
+  fill(map);
+  auto snapshot = map.snapshot();
+  auto deep = map.find(9);
+  auto root = map.find(10);
+  map[8] = 80; // copies 10, 5, 7, 8, which deep's path shares
+  deep->second = 90;
+  root->second = 100;
+  CHECK(map.valueOf(9) == 90 && map.valueOf(10) == 100 && map.valueOf(8) == 80);
+  CHECK(snapshot.valueOf(9) == 9 && snapshot.valueOf(10) == 10 && snapshot.valueOf(8) == 8);
+  ++root;
+  CHECK(root->first == 11);
+}
+
+// a lookup copies the path to the entry, not the tree
+void test_lookups_copy_paths_only()
+{
+  TreeMap<int, Counted> map;
+  std::mt19937 random(3);
+  std::vector<int> keys;
+  for (int key = 0; key < 4096; key++) keys.push_back(key);
+  std::shuffle(keys.begin(), keys.end(), random);
+  for (int key : keys) map[key] = Counted(key);
+
+  auto snapshot = map.snapshot();
+  Counted::copies = 0;
+  CHECK(map.find(100) != map.end());
+  CHECK(map.find(-1) == map.end());
+  map.find(2000)->second.value = 7;
+  CHECK(Counted::copies < 100);
+  CHECK(snapshot.valueOf(2000).value == 2000);
+  CHECK(map.valueOf(2000).value == 7);
+}
+
+// with the last snapshot gone, compact() may move nodes again
+void test_sharing_ends_with_last_snapshot()
+{
+  Map map;
+  std::mt19937 random(4);
+  for (int i = 0; i < 2000; i++) map[static_cast<int>(random() % 100000)] = i;
+  {
+    auto first = map.snapshot();
+    auto second = first;
+    map[-1] = 0;
+  }
+  map.compact();
+  const int *previous = nullptr;
+  bool contiguous = true;
+  std::ptrdiff_t stride = 0;
+  for (auto it = map.cbegin(); it != map.cend(); ++it)
+  {
+    const int *current = &it->first;
+    if (previous != nullptr)
+    {
+      if (stride == 0) stride = current - previous;
+      else if (current - previous != stride) contiguous = false;
+    }
+    previous = current;
+  }
+  CHECK(contiguous && stride > 0);
+}
+
+// random writes of every kind against std::map, with snapshots kept and checked all along
+void test_random_against_std_map()
+{
+  std::mt19937 random(5);
+  for (int round = 0; round < 100; round++)
+  {
+    Map map;
+    std::map<int, int> expected;
+    std::vector<std::pair<Map::Snapshot, std::map<int, int>>> snapshots;
+    for (int step = 0; step < 300; step++)
+    {
+      int key = static_cast<int>(random() % 50);
+      switch (random() % 9)
+      {
+        case 0: case 1: case 2:
+          map[key] = step;
+          expected[key] = step;
+          break;
+        case 3:
+          if (expected.count(key) != 0)
+          {
+            map.remove(key);
+            expected.erase(key);
+          }
+          break;
+        case 4:
+        {
+          auto it = map.find(key);
+          if (it != map.end() && ++it != map.end())
+          {
+            it->second = -step;
+            expected[it->first] = -step;
+          }
+          break;
+        }
+        case 5:
+          if (!expected.empty())
+          {
+            auto last = map.end();
+            --last;
+            last->second = step;
+            expected.rbegin()->second = step;
+          }
+          break;
+        case 6:
+        {
+          Map other;
+          other[key] = step;
+          map.insert(other.extract(key)).first->second = 2 * step;
+          expected[key] = 2 * step;
+          break;
+        }
+        case 7:
+          snapshots.emplace_back(map.snapshot(), expected);
+          if (snapshots.size() > 4) snapshots.erase(snapshots.begin());
+          break;
+        default:
+        {
+          auto it = map.insert(map.cend(), std::make_pair(key, step));
+          expected.insert(std::make_pair(key, step));
+          if (it != map.begin())
+          {
+            --it;
+            it->second += 1;
+            expected[it->first] += 1;
+          }
+        }
+      }
+      for (const auto& snapshot : snapshots) CHECK(holds(snapshot.first, snapshot.second));
+      CHECK(holds(map, expected));
+    }
+  }
+}
+
+// readers walk a snapshot on other threads while the writer changes the map and lets go of old snapshots
+void test_concurrent_readers()
+{
+  Map map;
+  for (int key = 0; key < 2000; key++) map[(key * 7919) % 2000] = key;
+  std::atomic<bool> failed(false);
+  for (int round = 0; round < 20; round++)
+  {
+    Map::Snapshot snapshot = map.snapshot();
+    std::vector<std::thread> readers;
+    for (int reader = 0; reader < 3; reader++)
+      readers.emplace_back([snapshot, &failed]
+      {
+        std::size_t seen = 0;
+        int previous = -1;
+        for (auto it = snapshot.begin(); it != snapshot.end(); ++it, seen++)
+          if (it->first <= previous) failed = true;
+          else previous = it->first;
+        if (seen != snapshot.getSize()) failed = true;
+      });
+    for (int key = 0; key < 500; key++)
+    {
+      map[(key * 31 + round) % 2500] = round;
+      if (key % 3 == 0 && map.find(key) != map.end()) map.remove(key);
+    }
+    for (auto& reader : readers) reader.join();
+  }
+  CHECK(!failed);
+}
+
+}
+
+int main()
+{
+  test_writes_through_iterators();
+  test_iterators_survive_other_writes();
+  test_lookups_copy_paths_only();
+  test_sharing_ends_with_last_snapshot();
+  test_random_against_std_map();
+  test_concurrent_readers();
+  return test::report("TreeMapSnapshotTest");
+}